@@ -0,0 +1,209 @@
+/*
+ * Benchmark for print indexes, reporting how much of a gallery each search
+ * passes on to full matching, and how often the right prints are among it.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Usage: index_bench [-p PERMILLE[,PERMILLE...]] DIR...
+ *
+ * Each DIR holds prints of one finger, one per file, as written out by
+ * fp_print_data_get_data(). Every print is indexed, then used in turn to
+ * search the index; the other prints from its directory are the ones the
+ * search should find.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <libfprint/fprint.h>
+
+static struct fp_print_data **prints;
+static int *fingers;
+static size_t nr_prints;
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static struct fp_print_data *load_print(const char *path)
+{
+	struct fp_print_data *data = NULL;
+	unsigned char *buf;
+	long len;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0) {
+		rewind(f);
+		buf = malloc(len);
+		if (buf && fread(buf, 1, len, f) == (size_t) len)
+			data = fp_print_data_from_data(buf, len);
+		free(buf);
+	}
+	fclose(f);
+	return data;
+}
+
+static int load_dir(const char *dirname, int finger)
+{
+	struct dirent *ent;
+	DIR *dir = opendir(dirname);
+
+	if (!dir) {
+		fprintf(stderr, "Could not open %s\n", dirname);
+		return -1;
+	}
+
+	while ((ent = readdir(dir))) {
+		struct fp_print_data *data;
+		char *path;
+
+		if (ent->d_name[0] == '.')
+			continue;
+		path = malloc(strlen(dirname) + strlen(ent->d_name) + 2);
+		sprintf(path, "%s/%s", dirname, ent->d_name);
+		data = load_print(path);
+		if (!data) {
+			fprintf(stderr, "Skipping %s, not a print\n", path);
+			free(path);
+			continue;
+		}
+		free(path);
+
+		prints = realloc(prints, (nr_prints + 2) * sizeof(*prints));
+		fingers = realloc(fingers, (nr_prints + 1) * sizeof(*fingers));
+		prints[nr_prints] = data;
+		fingers[nr_prints] = finger;
+		prints[++nr_prints] = NULL;
+	}
+
+	closedir(dir);
+	return 0;
+}
+
+static void run(struct fp_print_index *index, unsigned int permille)
+{
+	size_t searched = 0, mates = 0, found = 0;
+	double elapsed = 0;
+	size_t i, j, k;
+
+	fp_print_index_set_penetration(index, permille);
+
+	for (i = 0; i < nr_prints; i++) {
+		size_t nr_candidates;
+		size_t *candidates;
+		double start = now();
+
+		candidates = fp_print_index_search(index, prints[i], &nr_candidates);
+		elapsed += now() - start;
+		if (!candidates) {
+			fprintf(stderr, "Search failed for print %zd\n", i);
+			continue;
+		}
+
+		searched += nr_candidates;
+		for (j = 0; j < nr_prints; j++) {
+			if (j == i || fingers[j] != fingers[i])
+				continue;
+			mates++;
+			for (k = 0; k < nr_candidates; k++)
+				if (candidates[k] == j) {
+					found++;
+					break;
+				}
+		}
+		free(candidates);
+	}
+
+	printf("%8u %13.2f%% %9.2f%% %12.3f\n", permille,
+		100.0 * searched / ((double) nr_prints * nr_prints),
+		mates ? 100.0 * found / mates : 100.0,
+		1000.0 * elapsed / nr_prints);
+}
+
+int main(int argc, char **argv)
+{
+	const char *permilles = "10,20,50,100,200";
+	struct fp_print_index *index;
+	const char *p;
+	double start;
+	int r, i;
+
+	if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+		permilles = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2) {
+		fprintf(stderr, "Usage: index_bench [-p PERMILLE[,PERMILLE...]] "
+			"DIR...\n");
+		return 1;
+	}
+
+	r = fp_init();
+	if (r < 0) {
+		fprintf(stderr, "Failed to initialize libfprint\n");
+		exit(1);
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (load_dir(argv[i], i) < 0) {
+			r = 1;
+			goto out;
+		}
+	}
+	if (!nr_prints) {
+		fprintf(stderr, "No prints found.\n");
+		r = 1;
+		goto out;
+	}
+
+	start = now();
+	index = fp_print_index_new(prints);
+	if (!index) {
+		fprintf(stderr, "Could not index the prints; are they all from "
+			"imaging devices?\n");
+		r = 1;
+		goto out;
+	}
+	printf("Indexed %zd prints of %d fingers in %.3f seconds\n\n", nr_prints,
+		argc - 1, now() - start);
+
+	printf("permille   penetration    recall   search (ms)\n");
+	for (p = permilles; *p; p = strchr(p, ',') ? strchr(p, ',') + 1 : "")
+		run(index, atoi(p));
+
+	fp_print_index_free(index);
+out:
+	if (prints) {
+		size_t n;
+		for (n = 0; n < nr_prints; n++)
+			fp_print_data_free(prints[n]);
+		free(prints);
+		free(fingers);
+	}
+	fp_exit();
+	return r;
+}
@@ -84,6 +84,7 @@ void fpi_drvcb_close_complete(struct fp_dev *dev)
 	libusb_close(dev->udev);
 	if (dev->close_cb)
 		dev->close_cb(dev, dev->close_cb_data);
+	g_free(dev->identify_matches);
 	g_free(dev);
 }
 
@@ -311,17 +312,22 @@ API_EXPORTED int fp_async_verify_stop(struct fp_dev *dev,
 	return r;
 }
 
-API_EXPORTED int fp_async_identify_start(struct fp_dev *dev,
-	struct fp_print_data **gallery, fp_identify_cb callback, void *user_data)
+/* The array ranked identification reports its matches in. Its presence is
+ * also what tells the image device to rank, so it must not outlive the
+ * operation it was allocated for. */
+static void identify_free_matches(struct fp_dev *dev)
+{
+	g_free(dev->identify_matches);
+	dev->identify_matches = NULL;
+}
+
+static int identify_start(struct fp_dev *dev, struct fp_print_data **gallery,
+	void *user_data)
 {
 	struct fp_driver *drv = dev->drv;
 	int r;
 
-	fp_dbg("");
-	if (!drv->identify_start)
-		return -ENOTSUP;
 	dev->state = DEV_STATE_IDENTIFY_STARTING;
-	dev->identify_cb = callback;
 	dev->identify_cb_data = user_data;
 	dev->identify_gallery = gallery;
 
@@ -329,11 +335,108 @@ API_EXPORTED int fp_async_identify_start(struct fp_dev *dev,
 	if (r < 0) {
 		fp_err("identify_start failed with error %d", r);
 		dev->identify_cb = NULL;
+		dev->identify_ranked_cb = NULL;
+		identify_free_matches(dev);
 		dev->state = DEV_STATE_ERROR;
 	}
 	return r;
 }
 
+API_EXPORTED int fp_async_identify_start(struct fp_dev *dev,
+	struct fp_print_data **gallery, fp_identify_cb callback, void *user_data)
+{
+	struct fp_driver *drv = dev->drv;
+
+	fp_dbg("");
+	if (!drv->identify_start)
+		return -ENOTSUP;
+	dev->identify_cb = callback;
+	dev->identify_ranked_cb = NULL;
+	dev->identify_index = NULL;
+	dev->identify_gallery_obj = NULL;
+	identify_free_matches(dev);
+	return identify_start(dev, gallery, user_data);
+}
+
+/* Matches are reported by their handle in the gallery, which identify_report()
+ * looks up from the offset the driver reports. */
+API_EXPORTED int fp_async_identify_gallery_start(struct fp_dev *dev,
+	struct fp_gallery *gallery, fp_identify_cb callback, void *user_data)
+{
+	struct fp_driver *drv = dev->drv;
+
+	fp_dbg("");
+	if (!drv->identify_start)
+		return -ENOTSUP;
+	dev->identify_cb = callback;
+	dev->identify_ranked_cb = NULL;
+	dev->identify_index = NULL;
+	dev->identify_gallery_obj = gallery;
+	identify_free_matches(dev);
+	return identify_start(dev, fpi_gallery_get_prints(gallery), user_data);
+}
+
+/* Indexed identification searches the index for candidates before matching,
+ * which only imaging devices can do: the others match on the device. */
+API_EXPORTED int fp_async_identify_indexed_start(struct fp_dev *dev,
+	struct fp_print_index *idx, fp_identify_cb callback, void *user_data)
+{
+	struct fp_driver *drv = dev->drv;
+
+	fp_dbg("");
+	if (!drv->identify_start || drv->type != DRIVER_IMAGING)
+		return -ENOTSUP;
+	dev->identify_cb = callback;
+	dev->identify_ranked_cb = NULL;
+	dev->identify_index = idx;
+	dev->identify_gallery_obj = NULL;
+	identify_free_matches(dev);
+	return identify_start(dev, fpi_print_index_get_gallery(idx), user_data);
+}
+
+/* Ranked identification scores the scan against every print in the gallery,
+ * which only imaging devices can do: the others match on the device. */
+API_EXPORTED int fp_async_identify_ranked_start(struct fp_dev *dev,
+	struct fp_print_data **gallery, size_t max_matches,
+	fp_identify_ranked_cb callback, void *user_data)
+{
+	struct fp_driver *drv = dev->drv;
+
+	fp_dbg("max_matches=%zd", max_matches);
+	if (!drv->identify_start || drv->type != DRIVER_IMAGING)
+		return -ENOTSUP;
+	if (max_matches == 0)
+		return -EINVAL;
+
+	dev->identify_cb = NULL;
+	dev->identify_ranked_cb = callback;
+	dev->identify_index = NULL;
+	dev->identify_gallery_obj = NULL;
+	identify_free_matches(dev);
+	dev->identify_matches = g_new(struct fp_identify_match, max_matches);
+	dev->identify_max_matches = max_matches;
+	dev->identify_nr_matches = 0;
+	return identify_start(dev, gallery, user_data);
+}
+
+static void identify_report(struct fp_dev *dev, int result,
+	size_t match_offset, struct fp_img *img)
+{
+	if (dev->identify_ranked_cb) {
+		size_t nr_matches = result < 0 ? 0 : dev->identify_nr_matches;
+		dev->identify_ranked_cb(dev, result, dev->identify_matches,
+			nr_matches, img, dev->identify_cb_data);
+	} else if (dev->identify_cb) {
+		if (dev->identify_gallery_obj && result == FP_VERIFY_MATCH)
+			match_offset = fpi_gallery_get_handle(dev->identify_gallery_obj,
+				match_offset);
+		dev->identify_cb(dev, result, match_offset, img,
+			dev->identify_cb_data);
+	} else {
+		fp_dbg("ignoring identify result as no callback is subscribed");
+	}
+}
+
 /* Driver-lib: identification has started, expect results soon */
 void fpi_drvcb_identify_started(struct fp_dev *dev, int status)
 {
@@ -345,8 +448,7 @@ void fpi_drvcb_identify_started(struct fp_dev *dev, int status)
 			fp_dbg("adjusted to %d", status);
 		}
 		dev->state = DEV_STATE_ERROR;
-		if (dev->identify_cb)
-			dev->identify_cb(dev, status, 0, NULL, dev->identify_cb_data);
+		identify_report(dev, status, 0, NULL);
 	} else {
 		dev->state = DEV_STATE_IDENTIFYING;
 	}
@@ -363,10 +465,7 @@ void fpi_drvcb_report_identify_result(struct fp_dev *dev, int result,
 			|| result == FP_VERIFY_MATCH)
 		dev->state = DEV_STATE_IDENTIFY_DONE;
 
-	if (dev->identify_cb)
-		dev->identify_cb(dev, result, match_offset, img, dev->identify_cb_data);
-	else
-		fp_dbg("ignoring verify result as no callback is subscribed");
+	identify_report(dev, result, match_offset, img);
 }
 
 API_EXPORTED int fp_async_identify_stop(struct fp_dev *dev,
@@ -382,11 +481,14 @@ API_EXPORTED int fp_async_identify_stop(struct fp_dev *dev,
 
 	dev->state = DEV_STATE_IDENTIFY_STOPPING;
 	dev->identify_cb = NULL;
+	dev->identify_ranked_cb = NULL;
 	dev->identify_stop_cb = callback;
 	dev->identify_stop_cb_data = user_data;
 
-	if (!drv->identify_start)
-		return -ENOTSUP;	
+	if (!drv->identify_start) {
+		identify_free_matches(dev);
+		return -ENOTSUP;
+	}
 	if (!drv->identify_stop) {
 		dev->state = DEV_STATE_INITIALIZED;
 		fpi_drvcb_identify_stopped(dev);
@@ -397,6 +499,7 @@ API_EXPORTED int fp_async_identify_stop(struct fp_dev *dev,
 	if (r < 0) {
 		fp_err("failed to stop identification");
 		dev->identify_stop_cb = NULL;
+		identify_free_matches(dev);
 	}
 
 	return r;
@@ -408,6 +511,7 @@ void fpi_drvcb_identify_stopped(struct fp_dev *dev)
 	fp_dbg("");
 	BUG_ON(dev->state != DEV_STATE_IDENTIFY_STOPPING);
 	dev->state = DEV_STATE_INITIALIZED;
+	identify_free_matches(dev);
 	if (dev->identify_stop_cb)
 		dev->identify_stop_cb(dev, dev->identify_stop_cb_data);
 }
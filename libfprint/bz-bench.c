@@ -0,0 +1,279 @@
+/*
+ * Throughput and cache benchmark for the bozorth3 matcher
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Usage: bz-bench [-n PRINTS] [-c CONTEXTS] [-r ROUNDS]
+ *
+ * Matches PRINTS synthetic probes against as many synthetic gallery prints,
+ * half of them mated, spreading the matches over CONTEXTS matcher contexts in
+ * turn to mimic several matchers sharing a core. This is built twice, as
+ * bz-bench with the 16-bit matcher tables and as bz-bench-wide with
+ * BZ_WIDE_TABLES; both must print the same score checksum. Neither is built
+ * by default, use "make bz-bench bz-bench-wide".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <bozorth.h>
+
+#define BENCH_AREA_X	320
+#define BENCH_AREA_Y	400
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned int rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state >> 11;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int cmp_minutia(const void *a, const void *b)
+{
+	const int *p = a, *q = b;
+	if (p[0] != q[0])
+		return p[0] - q[0];
+	return p[1] - q[1];
+}
+
+/* bozorth3 wants its minutiae in x, then y order */
+static void set_xyt(struct xyt_struct *xyt, int pts[][3], int n)
+{
+	int i;
+
+	qsort(pts, n, sizeof(pts[0]), cmp_minutia);
+	xyt->nrows = n;
+	for (i = 0; i < n; i++) {
+		xyt->xcol[i] = pts[i][0];
+		xyt->ycol[i] = pts[i][1];
+		xyt->thetacol[i] = pts[i][2];
+	}
+}
+
+static void random_minutia(int *pt)
+{
+	pt[0] = rng() % BENCH_AREA_X + 20;
+	pt[1] = rng() % BENCH_AREA_Y + 20;
+	pt[2] = (int) (rng() % 360) - 179;
+}
+
+/* Fills in a probe and a gallery print. A mated gallery print is the probe
+ * turned and shifted a little, with jittered, dropped and spurious minutiae,
+ * roughly what a second impression of the same finger looks like. */
+static void make_pair(struct xyt_struct *probe, struct xyt_struct *gallery,
+	int mated)
+{
+	static int p[MAX_BOZORTH_MINUTIAE][3], g[MAX_BOZORTH_MINUTIAE][3];
+	int n = 30 + rng() % 40;
+	double angle = ((int) (rng() % 30) - 15) * M_PI / 180;
+	int dx = (int) (rng() % 30) - 15;
+	int dy = (int) (rng() % 30) - 15;
+	int i, m = 0;
+
+	for (i = 0; i < n; i++)
+		random_minutia(p[i]);
+
+	if (!mated) {
+		m = n - 10 + rng() % 20;
+		for (i = 0; i < m; i++)
+			random_minutia(g[i]);
+	} else {
+		for (i = 0; i < n; i++) {
+			double x = p[i][0] - 200, y = p[i][1] - 200;
+			int t;
+
+			if (rng() % 6 == 0)
+				continue;
+			g[m][0] = (int) (x * cos(angle) - y * sin(angle)) + 200 + dx
+				+ (int) (rng() % 5) - 2;
+			g[m][1] = (int) (x * sin(angle) + y * cos(angle)) + 200 + dy
+				+ (int) (rng() % 5) - 2;
+			t = p[i][2] + (int) (angle * 180 / M_PI) + (int) (rng() % 9) - 4;
+			g[m][2] = IANGLE180(t);
+			m++;
+		}
+		while (m < n && rng() % 3)
+			random_minutia(g[m++]);
+	}
+
+	set_xyt(probe, p, n);
+	set_xyt(gallery, g, m);
+}
+
+#ifdef __linux__
+static int counter_open(unsigned int type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void counter_start(int fd)
+{
+	if (fd < 0)
+		return;
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static void counter_report(int fd, const char *name, double matches)
+{
+	unsigned long long count;
+
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+		printf("%-24s n/a (no access to performance counters)\n", name);
+		return;
+	}
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	printf("%-24s %llu (%.0f per match)\n", name, count, count / matches);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+	struct xyt_struct *probes, *gallery;
+	struct bz_web **probe_webs, **gallery_webs;
+	struct bz_ctx **ctxs;
+	int nr_prints = 100, nr_ctxs = 1, nr_rounds = 1;
+	unsigned long checksum = 0;
+	size_t web_bytes = 0;
+	double start, elapsed, matches;
+	int i, j, r, c = 0;
+#ifdef __linux__
+	int misses, l1_misses;
+#endif
+
+	for (i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "-n") == 0)
+			nr_prints = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-c") == 0)
+			nr_ctxs = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "-r") == 0)
+			nr_rounds = atoi(argv[i + 1]);
+		else
+			break;
+	}
+	if (i < argc || nr_prints < 1 || nr_ctxs < 1 || nr_rounds < 1) {
+		fprintf(stderr, "Usage: bz-bench [-n PRINTS] [-c CONTEXTS] "
+			"[-r ROUNDS]\n");
+		return 1;
+	}
+
+	probes = calloc(nr_prints, sizeof(*probes));
+	gallery = calloc(nr_prints, sizeof(*gallery));
+	probe_webs = calloc(nr_prints, sizeof(*probe_webs));
+	gallery_webs = calloc(nr_prints, sizeof(*gallery_webs));
+	ctxs = calloc(nr_ctxs, sizeof(*ctxs));
+	if (!probes || !gallery || !probe_webs || !gallery_webs || !ctxs) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < nr_ctxs; i++) {
+		ctxs[i] = bz_ctx_new();
+		if (ctxs[i] == BZ_CTX_NULL)
+			return 1;
+	}
+
+	for (i = 0; i < nr_prints; i++) {
+		make_pair(&probes[i], &gallery[i], i % 2 == 0);
+		probe_webs[i] = bozorth_web_new(ctxs[0], &probes[i]);
+		gallery_webs[i] = bozorth_web_new(ctxs[0], &gallery[i]);
+		if (probe_webs[i] == BZ_WEB_NULL || gallery_webs[i] == BZ_WEB_NULL)
+			return 1;
+		web_bytes += gallery_webs[i]->nrows
+			* (sizeof(bz_tab_t *) + sizeof(gallery_webs[i]->cols[0]));
+	}
+
+	printf("%-24s %zd bits\n", "table entries", sizeof(bz_tab_t) * 8);
+	printf("%-24s %zd bytes\n", "matcher context", sizeof(struct bz_ctx));
+	printf("%-24s %zd bytes\n", "gallery web (average)",
+		web_bytes / nr_prints);
+
+#ifdef __linux__
+	misses = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	l1_misses = counter_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	counter_start(misses);
+	counter_start(l1_misses);
+#endif
+
+	start = now();
+	for (r = 0; r < nr_rounds; r++) {
+		for (i = 0; i < nr_prints; i++) {
+			for (j = 0; j < nr_prints; j++) {
+				struct bz_ctx *ctx = ctxs[c];
+				int len = bozorth_probe_web(ctx, probe_webs[i]);
+				int score = bozorth_to_gallery_web(ctx, len, &probes[i],
+					&gallery[j], gallery_webs[j]);
+
+				checksum = checksum * 31 + score;
+				c = (c + 1) % nr_ctxs;
+			}
+		}
+	}
+	elapsed = now() - start;
+	matches = (double) nr_rounds * nr_prints * nr_prints;
+
+#ifdef __linux__
+	counter_report(misses, "cache misses", matches);
+	counter_report(l1_misses, "L1 data read misses", matches);
+#endif
+	printf("%-24s %.0f in %.3f seconds, %.0f per second\n", "matches",
+		matches, elapsed, matches / elapsed);
+	printf("%-24s %08lx\n", "score checksum", checksum & 0xffffffffUL);
+
+	for (i = 0; i < nr_prints; i++) {
+		bozorth_web_free(probe_webs[i]);
+		bozorth_web_free(gallery_webs[i]);
+	}
+	for (i = 0; i < nr_ctxs; i++)
+		bz_ctx_free(ctxs[i]);
+	free(probes);
+	free(gallery);
+	free(probe_webs);
+	free(gallery_webs);
+	free(ctxs);
+	return 0;
+}
@@ -561,7 +561,7 @@ enum fp_print_data_type fpi_driver_get_data_type(struct fp_driver *drv)
 	case DRIVER_PRIMITIVE:
 		return PRINT_DATA_RAW;
 	case DRIVER_IMAGING:
-		return PRINT_DATA_NBIS_MINUTIAE;
+		return PRINT_DATA_NBIS_COMPACT;
 	default:
 		fp_err("unrecognised drv type %d", drv->type);
 		return PRINT_DATA_RAW;
@@ -904,6 +904,7 @@ API_EXPORTED int fp_init(void)
 	}
 
 	register_drivers();
+	fpi_img_init();
 	fpi_poll_init();
 	return 0;
 }
@@ -931,7 +932,9 @@ API_EXPORTED void fp_exit(void)
 		opened_devices = NULL;
 	}
 
+	fpi_imgdev_exit();
 	fpi_data_exit();
+	fpi_img_exit();
 	fpi_poll_exit();
 	g_slist_free(registered_drivers);
 	registered_drivers = NULL;
@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -64,9 +65,15 @@ static void storage_setup(void)
 	/* FIXME handle failure */
 }
 
+static void load_pool_exit(void);
+static void store_index_exit(void);
+
 void fpi_data_exit(void)
 {
+	load_pool_exit();
+	store_index_exit();
 	g_free(base_store);
+	base_store = NULL;
 }
 
 #define FP_FINGER_IS_VALID(finger) \
@@ -104,6 +111,7 @@ static struct fp_print_data *print_data_new(uint16_t driver_id,
 	data->devtype = devtype;
 	data->type = type;
 	data->length = length;
+	data->data = (unsigned char *) (data + 1);
 	return data;
 }
 
@@ -117,6 +125,11 @@ struct fp_print_data *fpi_print_data_new(struct fp_dev *dev, size_t length)
  * Convert a stored print into a unified representation inside a data buffer.
  * You can then store this data buffer in any way that suits you, and load
  * it back at some later time using fp_print_data_from_data().
+ *
+ * Prints from imaging devices are encoded the same way on every machine.
+ * Those made by older versions of libfprint keep their original format, and
+ * their buffer also carries matcher data derived from the print, so that
+ * loading it back later does not have to recompute it.
  * \param data the stored print
  * \param ret output location for the data buffer. Must be freed with free()
  * after use.
@@ -127,10 +140,12 @@ API_EXPORTED size_t fp_print_data_get_data(struct fp_print_data *data,
 {
 	struct fpi_print_data_fp1 *buf;
 	size_t buflen;
+	size_t web_len;
 
 	fp_dbg("");
 
-	buflen = sizeof(*buf) + data->length;
+	web_len = fpi_img_print_data_web_size(data);
+	buflen = sizeof(*buf) + data->length + web_len;
 	buf = malloc(buflen);
 	if (!buf)
 		return 0;
@@ -143,6 +158,8 @@ API_EXPORTED size_t fp_print_data_get_data(struct fp_print_data *data,
 	buf->devtype = GUINT32_TO_LE(data->devtype);
 	buf->data_type = data->type;
 	memcpy(buf->data, data->data, data->length);
+	if (web_len)
+		fpi_img_print_data_web_write(data, buf->data + data->length);
 	return buflen;
 }
 
@@ -158,24 +175,49 @@ API_EXPORTED size_t fp_print_data_get_data(struct fp_print_data *data,
 API_EXPORTED struct fp_print_data *fp_print_data_from_data(unsigned char *buf,
 	size_t buflen)
 {
-	struct fpi_print_data_fp1 *raw = (struct fpi_print_data_fp1 *) buf;
-	size_t print_data_len;
+	struct fp_print_data view;
 	struct fp_print_data *data;
 
 	fp_dbg("buffer size %zd", buflen);
-	if (buflen < sizeof(*raw))
+	if (!fpi_print_data_view(&view, buf, buflen))
 		return NULL;
 
+	data = print_data_new(view.driver_id, view.devtype, view.type,
+		view.length);
+	memcpy(data->data, view.data, view.length);
+	data->web = view.web;
+	return data;
+}
+
+/* Fills in data from a buffer made by fp_print_data_get_data(), leaving the
+ * print's payload in place: data points into buf, which must outlive it.
+ * Returns FALSE if buf does not hold a usable print. */
+gboolean fpi_print_data_view(struct fp_print_data *data, unsigned char *buf,
+	size_t buflen)
+{
+	struct fpi_print_data_fp1 *raw = (struct fpi_print_data_fp1 *) buf;
+
+	if (buflen < sizeof(*raw))
+		return FALSE;
+
 	if (strncmp(raw->prefix, "FP1", 3) != 0) {
 		fp_dbg("bad header prefix");
-		return NULL;
+		return FALSE;
 	}
 
-	print_data_len = buflen - sizeof(*raw);
-	data = print_data_new(GUINT16_FROM_LE(raw->driver_id),
-		GUINT32_FROM_LE(raw->devtype), raw->data_type, print_data_len);
-	memcpy(data->data, raw->data, print_data_len);
-	return data;
+	memset(data, 0, sizeof(*data));
+	data->driver_id = GUINT16_FROM_LE(raw->driver_id);
+	data->devtype = GUINT32_FROM_LE(raw->devtype);
+	data->type = raw->data_type;
+	data->length = buflen - sizeof(*raw);
+	data->data = raw->data;
+	fpi_img_print_data_web_read(data);
+	if (!fpi_img_print_data_is_valid(data)) {
+		fp_dbg("corrupt print data");
+		fpi_img_print_data_free_web(data);
+		return FALSE;
+	}
+	return TRUE;
 }
 
 static char *get_path_to_storedir(uint16_t driver_id, uint32_t devtype)
@@ -283,6 +325,11 @@ gboolean fpi_print_data_compatible(uint16_t driver_id1, uint32_t devtype1,
 		return FALSE;
 	}
 
+	/* prints from imaging devices made before and after the compact
+	 * encoding was introduced are equally usable */
+	if (PRINT_DATA_IS_NBIS(type1) && PRINT_DATA_IS_NBIS(type2))
+		return TRUE;
+
 	if (type1 != type2) {
 		fp_dbg("type mismatch: %d vs %d", type1, type2);
 		return FALSE;
@@ -400,12 +447,149 @@ API_EXPORTED int fp_print_data_from_dscv_print(struct fp_dscv_print *print,
 	return load_from_file(print->path, data);
 }
 
+/* Discovered prints are loaded by a pool of threads shared by all callers.
+ * Loading mostly waits on the disk rather than the processor, so there are
+ * more of them than there are processors. */
+#define LOAD_THREADS_PER_CPU 2
+
+/* Prints are claimed by the loading threads this many at a time. */
+#define LOAD_CHUNK_SIZE 16
+
+struct load_job {
+	struct fp_dscv_print **prints;
+	size_t nr_prints;
+	struct fp_print_data **loaded;
+	int *errors;
+	/* first print not yet claimed */
+	gint next;
+};
+
+static struct fpi_work_pool load_pool =
+	FPI_WORK_POOL_INIT("loading", LOAD_THREADS_PER_CPU);
+
+static void load_pool_exit(void)
+{
+	fpi_work_pool_exit(&load_pool);
+}
+
+static void load_run(void *arg)
+{
+	struct load_job *job = arg;
+	size_t start, end, i;
+
+	while ((start = g_atomic_int_add(&job->next, LOAD_CHUNK_SIZE))
+			< job->nr_prints) {
+		end = MIN(start + LOAD_CHUNK_SIZE, job->nr_prints);
+		for (i = start; i < end; i++) {
+			struct fp_dscv_print *print = job->prints[i];
+			struct fp_print_data *data = NULL;
+			int r = load_from_file(print->path, &data);
+
+			/* the print must be what its place in the store says it is */
+			if (r == 0 && (data->driver_id != print->driver_id
+					|| data->devtype != print->devtype)) {
+				fp_err("%s does not hold a print for %04x/%08x",
+					print->path, print->driver_id, print->devtype);
+				fp_print_data_free(data);
+				data = NULL;
+				r = -EINVAL;
+			}
+			job->loaded[i] = data;
+			job->errors[i] = r;
+		}
+	}
+}
+
+/** \ingroup print_data
+ * Loads a whole set of discovered prints, for example to build a gallery
+ * for identification. The prints are loaded and checked concurrently, which
+ * is much faster than calling fp_print_data_from_dscv_print() on each of
+ * them in turn when there are many.
+ *
+ * Prints which cannot be loaded are left out of the returned gallery; the
+ * others appear in it in the order of the discovered prints list. A print
+ * whose contents do not match the driver ID and devtype it was discovered
+ * under counts as one that cannot be loaded.
+ *
+ * \param prints NULL-terminated list of discovered prints, as returned by
+ * fp_discover_prints() or fp_discover_prints_for_devtype()
+ * \param errors output array with one entry per discovered print, or NULL.
+ * Each entry is set to 0 if that print was loaded, and otherwise to the error
+ * code fp_print_data_from_dscv_print() would have returned for it.
+ * \returns a NULL-terminated array of the prints that were loaded, must be
+ * freed with fp_print_data_gallery_free() after use.
+ */
+API_EXPORTED struct fp_print_data **fp_dscv_prints_load(
+	struct fp_dscv_print **prints, int *errors)
+{
+	struct load_job job;
+	struct fp_print_data **gallery;
+	struct fpi_work *work = NULL;
+	GTimer *timer;
+	int nthreads = 0;
+	size_t i, j;
+
+	memset(&job, 0, sizeof(job));
+	while (prints[job.nr_prints])
+		job.nr_prints++;
+	job.prints = prints;
+	job.loaded = g_new0(struct fp_print_data *, job.nr_prints);
+	job.errors = errors ? errors : g_new(int, job.nr_prints);
+
+	timer = g_timer_new();
+	if (job.nr_prints > LOAD_CHUNK_SIZE)
+		nthreads = fpi_work_pool_threads(&load_pool);
+	nthreads = MIN(nthreads,
+		(job.nr_prints + LOAD_CHUNK_SIZE - 1) / LOAD_CHUNK_SIZE - 1);
+
+	if (nthreads > 0)
+		work = fpi_work_start(&load_pool, nthreads, load_run, &job);
+	load_run(&job);
+	if (work)
+		fpi_work_finish(work);
+
+	gallery = g_new(struct fp_print_data *, job.nr_prints + 1);
+	for (i = 0, j = 0; i < job.nr_prints; i++)
+		if (job.loaded[i])
+			gallery[j++] = job.loaded[i];
+	gallery[j] = NULL;
+
+	g_timer_stop(timer);
+	fp_dbg("loaded %zd of %zd prints with %d helpers in %f seconds", j,
+		job.nr_prints, nthreads, g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	g_free(job.loaded);
+	if (!errors)
+		g_free(job.errors);
+	return gallery;
+}
+
+/** \ingroup print_data
+ * Frees a gallery returned by fp_dscv_prints_load(), along with all of the
+ * prints it holds.
+ * \param gallery the gallery to destroy. If NULL, function simply returns.
+ */
+API_EXPORTED void fp_print_data_gallery_free(struct fp_print_data **gallery)
+{
+	int i;
+
+	if (!gallery)
+		return;
+
+	for (i = 0; gallery[i]; i++)
+		fp_print_data_free(gallery[i]);
+	g_free(gallery);
+}
+
 /** \ingroup print_data
  * Frees a stored print. Must be called when you are finished using the print.
  * \param data the stored print to destroy. If NULL, function simply returns.
  */
 API_EXPORTED void fp_print_data_free(struct fp_print_data *data)
 {
+	if (data)
+		fpi_img_print_data_free_web(data);
 	g_free(data);
 }
 
@@ -464,21 +648,107 @@ API_EXPORTED uint32_t fp_print_data_get_devtype(struct fp_print_data *data)
  * been deleted by the time you come to load it.
  */
 
-static GSList *scan_dev_store_dir(char *devpath, uint16_t driver_id,
-	uint32_t devtype, GSList *list)
+/* Discovery runs often, to pick up new enrollments, and would otherwise read
+ * every directory of the store each time. Instead, the entries of each
+ * directory are kept once read, along with its modification time. Adding or
+ * removing an entry updates the modification time of the directory, so a
+ * directory whose time has not changed is not read again. Those times only
+ * have a resolution of one second, so a directory modified in the second it
+ * was read in may have changed unnoticed; it gets read again next time. */
+struct store_dir {
+	time_t mtime;
+	/* when the directory was last read */
+	time_t read_at;
+	/* NULL-terminated list of the names of the entries */
+	gchar **names;
+};
+
+G_LOCK_DEFINE_STATIC(store_index);
+static GHashTable *store_index = NULL;
+
+static void store_dir_free(struct store_dir *sdir)
+{
+	g_strfreev(sdir->names);
+	g_free(sdir);
+}
+
+/* Returns the names of the entries in a directory of the store, reading it
+ * only if it changed since last time. Must be called with store_index held.
+ * The list belongs to the index and is valid until store_index is released.
+ * Returns NULL on error. */
+static gchar **store_dir_list(const char *path)
 {
+	struct store_dir *sdir;
+	GStatBuf st;
 	GError *err = NULL;
+	GPtrArray *names;
 	const gchar *ent;
-	struct fp_dscv_print *print;
+	time_t read_at;
+	GDir *dir;
+
+	if (!store_index)
+		store_index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify) store_dir_free);
+
+	if (g_stat(path, &st) < 0) {
+		fp_err("stat %s failed: %s", path, g_strerror(errno));
+		g_hash_table_remove(store_index, path);
+		return NULL;
+	}
 
-	GDir *dir = g_dir_open(devpath, 0, &err);
+	sdir = g_hash_table_lookup(store_index, path);
+	if (sdir && sdir->mtime == st.st_mtime && sdir->read_at > st.st_mtime)
+		return sdir->names;
+
+	read_at = time(NULL);
+	dir = g_dir_open(path, 0, &err);
 	if (!dir) {
-		fp_err("opendir %s failed: %s", devpath, err->message);
+		fp_err("opendir %s failed: %s", path, err->message);
 		g_error_free(err);
-		return list;
+		g_hash_table_remove(store_index, path);
+		return NULL;
+	}
+
+	fp_dbg("reading %s", path);
+	names = g_ptr_array_new();
+	while ((ent = g_dir_read_name(dir)))
+		g_ptr_array_add(names, g_strdup(ent));
+	g_ptr_array_add(names, NULL);
+	g_dir_close(dir);
+
+	if (sdir) {
+		g_strfreev(sdir->names);
+	} else {
+		sdir = g_malloc(sizeof(*sdir));
+		g_hash_table_insert(store_index, g_strdup(path), sdir);
 	}
+	sdir->names = (gchar **) g_ptr_array_free(names, FALSE);
+	sdir->mtime = st.st_mtime;
+	sdir->read_at = read_at;
+	return sdir->names;
+}
+
+static void store_index_exit(void)
+{
+	G_LOCK(store_index);
+	if (store_index)
+		g_hash_table_destroy(store_index);
+	store_index = NULL;
+	G_UNLOCK(store_index);
+}
 
-	while ((ent = g_dir_read_name(dir))) {
+static GSList *scan_dev_store_dir(char *devpath, uint16_t driver_id,
+	uint32_t devtype, GSList *list)
+{
+	gchar **ents;
+	const gchar *ent;
+	struct fp_dscv_print *print;
+
+	ents = store_dir_list(devpath);
+	if (!ents)
+		return list;
+
+	while ((ent = *ents++)) {
 		/* ent is an 1 hex character fp_finger code */
 		guint64 val;
 		enum fp_finger finger;
@@ -502,24 +772,20 @@ static GSList *scan_dev_store_dir(char *devpath, uint16_t driver_id,
 		list = g_slist_prepend(list, print);
 	}
 
-	g_dir_close(dir);
 	return list;
 }
 
 static GSList *scan_driver_store_dir(char *drvpath, uint16_t driver_id,
 	GSList *list)
 {
-	GError *err = NULL;
+	gchar **ents;
 	const gchar *ent;
 
-	GDir *dir = g_dir_open(drvpath, 0, &err);
-	if (!dir) {
-		fp_err("opendir %s failed: %s", drvpath, err->message);
-		g_error_free(err);
+	ents = store_dir_list(drvpath);
+	if (!ents)
 		return list;
-	}
 
-	while ((ent = g_dir_read_name(dir))) {
+	while ((ent = *ents++)) {
 		/* ent is an 8 hex character devtype */
 		guint64 val;
 		uint32_t devtype;
@@ -541,7 +807,24 @@ static GSList *scan_driver_store_dir(char *drvpath, uint16_t driver_id,
 		g_free(path);
 	}
 
-	g_dir_close(dir);
+	return list;
+}
+
+static struct fp_dscv_print **dscv_list_to_array(GSList *tmplist)
+{
+	GSList *elem;
+	unsigned int tmplist_len;
+	struct fp_dscv_print **list;
+	unsigned int i;
+
+	tmplist_len = g_slist_length(tmplist);
+	list = g_malloc(sizeof(*list) * (tmplist_len + 1));
+	elem = tmplist;
+	for (i = 0; i < tmplist_len; i++, elem = g_slist_next(elem))
+		list[i] = elem->data;
+	list[tmplist_len] = NULL; /* NULL-terminate */
+
+	g_slist_free(tmplist);
 	return list;
 }
 
@@ -553,26 +836,21 @@ static GSList *scan_driver_store_dir(char *drvpath, uint16_t driver_id,
  */
 API_EXPORTED struct fp_dscv_print **fp_discover_prints(void)
 {
-	GDir *dir;
+	gchar **ents;
 	const gchar *ent;
-	GError *err = NULL;
 	GSList *tmplist = NULL;
-	GSList *elem;
-	unsigned int tmplist_len;
-	struct fp_dscv_print **list;
-	unsigned int i;
 
 	if (!base_store)
 		storage_setup();
 
-	dir = g_dir_open(base_store, 0, &err);
-	if (!dir) {
-		fp_err("opendir %s failed: %s", base_store, err->message);
-		g_error_free(err);
+	G_LOCK(store_index);
+	ents = store_dir_list(base_store);
+	if (!ents) {
+		G_UNLOCK(store_index);
 		return NULL;
 	}
 
-	while ((ent = g_dir_read_name(dir))) {
+	while ((ent = *ents++)) {
 		/* ent is a 4 hex digit driver_id */
 		gchar *endptr;
 		gchar *path;
@@ -594,16 +872,37 @@ API_EXPORTED struct fp_dscv_print **fp_discover_prints(void)
 		g_free(path);
 	}
 
-	g_dir_close(dir);
-	tmplist_len = g_slist_length(tmplist);
-	list = g_malloc(sizeof(*list) * (tmplist_len + 1));
-	elem = tmplist;
-	for (i = 0; i < tmplist_len; i++, elem = g_slist_next(elem))
-		list[i] = elem->data;
-	list[tmplist_len] = NULL; /* NULL-terminate */
+	G_UNLOCK(store_index);
+	return dscv_list_to_array(tmplist);
+}
 
-	g_slist_free(tmplist);
-	return list;
+/** \ingroup dscv_print
+ * Scans the users home directory and returns a list of the prints that were
+ * previously saved using fp_print_data_save() for one type of device. Unlike
+ * fp_discover_prints(), only the directory holding those prints is scanned.
+ * \param driver_id the \ref driver_id "driver ID" of the prints to discover
+ * \param devtype the \ref devtype "devtype" of the prints to discover
+ * \returns a NULL-terminated list of discovered prints, must be freed with
+ * fp_dscv_prints_free() after use.
+ */
+API_EXPORTED struct fp_dscv_print **fp_discover_prints_for_devtype(
+	uint16_t driver_id, uint32_t devtype)
+{
+	GSList *tmplist = NULL;
+	gchar *path;
+
+	if (!base_store)
+		storage_setup();
+
+	path = get_path_to_storedir(driver_id, devtype);
+	/* a device type nothing was ever saved for simply has no prints */
+	if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+		G_LOCK(store_index);
+		tmplist = scan_dev_store_dir(path, driver_id, devtype, NULL);
+		G_UNLOCK(store_index);
+	}
+	g_free(path);
+	return dscv_list_to_array(tmplist);
 }
 
 /** \ingroup dscv_print
@@ -0,0 +1,206 @@
+/*
+ * Consistency check and benchmark for the mindtct vector kernels
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Usage: dft-check [-n IMAGES] [-w WIDTH] [-h HEIGHT]
+ *
+ * Runs minutiae detection on IMAGES synthetic ridge patterns twice, once
+ * with the vector DFT and binarization kernels and once with the scalar code
+ * alone, and checks that both give the same image maps, binary image and
+ * minutiae. Exits non-zero if they differ. Prints the time spent by each.
+ * Not built by default, use "make dft-check".
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <lfs.h>
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned int rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state >> 11;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Ridges curving around a core point, with a varying period and some
+ * noise, so that blocks see every direction. */
+static void make_image(unsigned char *img, int width, int height)
+{
+	double cx = width * (0.3 + 0.4 * (rng() % 1000) / 1000.0);
+	double cy = height * (0.3 + 0.4 * (rng() % 1000) / 1000.0);
+	double period = 7.0 + (rng() % 400) / 100.0;
+	double twist = (rng() % 1000) / 1000.0;
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			double dx = x - cx, dy = y - cy;
+			double r = sqrt(dx * dx + dy * dy);
+			double a = atan2(dy, dx);
+			double v = sin(2 * M_PI * (r + twist * 8 * a) / period);
+			int p = 128 + (int) (90 * v) + (int) (rng() % 41) - 20;
+			img[y * width + x] = p < 0 ? 0 : p > 255 ? 255 : p;
+		}
+	}
+}
+
+struct result {
+	MINUTIAE *minutiae;
+	int *maps[5];
+	int map_w, map_h;
+	unsigned char *bdata;
+};
+
+static int detect(struct result *res, unsigned char *img, int width,
+	int height, const LFSTABLES *tables)
+{
+	int bw, bh, bd;
+
+	return get_minutiae(&res->minutiae, &res->maps[0], &res->maps[1],
+		&res->maps[2], &res->maps[3], &res->maps[4], &res->map_w,
+		&res->map_h, &res->bdata, &bw, &bh, &bd, img, width, height, 8,
+		500 / 25.4, &lfsparms_V2, tables);
+}
+
+static void free_result(struct result *res)
+{
+	int i;
+
+	free_minutiae(res->minutiae);
+	for (i = 0; i < 5; i++)
+		free(res->maps[i]);
+	free(res->bdata);
+}
+
+/* Returns the number of differences between two results */
+static int compare(struct result *a, struct result *b, int width, int height)
+{
+	int nblocks = a->map_w * a->map_h;
+	int diffs = 0;
+	int i, j;
+
+	for (i = 0; i < 5; i++)
+		for (j = 0; j < nblocks; j++)
+			diffs += a->maps[i][j] != b->maps[i][j];
+	diffs += memcmp(a->bdata, b->bdata, width * height) != 0;
+
+	if (a->minutiae->num != b->minutiae->num)
+		return diffs + 1;
+	for (i = 0; i < a->minutiae->num; i++) {
+		struct fp_minutia *p = a->minutiae->list[i];
+		struct fp_minutia *q = b->minutiae->list[i];
+		diffs += p->x != q->x || p->y != q->y
+			|| p->direction != q->direction
+			|| p->reliability != q->reliability;
+	}
+	return diffs;
+}
+
+int main(int argc, char **argv)
+{
+	int nimages = 20, width = 256, height = 360;
+	double t_simd = 0, t_scalar = 0, t;
+	LFSTABLES *tables;
+	unsigned char *img;
+	int failed = 0;
+	int i, opt, r;
+
+	while ((opt = getopt(argc, argv, "n:w:h:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nimages = atoi(optarg);
+			break;
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'h':
+			height = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n IMAGES] [-w WIDTH] [-h HEIGHT]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	r = init_lfs_tables(&tables, width, height, &lfsparms_V2);
+	if (r) {
+		fprintf(stderr, "could not build tables: %d\n", r);
+		return 1;
+	}
+	img = malloc(width * height);
+
+	for (i = 0; i < nimages; i++) {
+		struct result simd, scalar;
+		int diffs;
+
+		make_image(img, width, height);
+
+		set_dft_simd(1);
+		set_binar_simd(1);
+		t = now();
+		r = detect(&simd, img, width, height, tables);
+		t_simd += now() - t;
+		if (r) {
+			fprintf(stderr, "image %d: detection failed: %d\n", i, r);
+			return 1;
+		}
+
+		set_dft_simd(0);
+		set_binar_simd(0);
+		t = now();
+		r = detect(&scalar, img, width, height, tables);
+		t_scalar += now() - t;
+		if (r) {
+			fprintf(stderr, "image %d: detection failed: %d\n", i, r);
+			return 1;
+		}
+
+		diffs = compare(&simd, &scalar, width, height);
+		if (diffs) {
+			printf("image %d: %d differences\n", i, diffs);
+			failed = 1;
+		}
+		free_result(&simd);
+		free_result(&scalar);
+	}
+
+	printf("%d images of %dx%d: %.2f ms with vector kernels, "
+		"%.2f ms scalar\n", nimages, width, height,
+		t_simd * 1000 / nimages, t_scalar * 1000 / nimages);
+	printf("%s\n", failed ? "MISMATCH" : "identical");
+
+	free(img);
+	free_lfs_tables(tables);
+	return failed;
+}
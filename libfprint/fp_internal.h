@@ -124,12 +124,22 @@ struct fp_dev {
 	fp_verify_stop_cb verify_stop_cb;
 	void *verify_stop_cb_data;
 	fp_identify_cb identify_cb;
+	fp_identify_ranked_cb identify_ranked_cb;
 	void *identify_cb_data;
 	fp_identify_stop_cb identify_stop_cb;
 	void *identify_stop_cb_data;
 
 	/* FIXME: better place to put this? */
 	struct fp_print_data **identify_gallery;
+	/* index over identify_gallery, only used for indexed identification */
+	struct fp_print_index *identify_index;
+	/* gallery object identify_gallery belongs to, when identifying against
+	 * one: matches are then reported by handle */
+	struct fp_gallery *identify_gallery_obj;
+	/* ranked identification results, only used with identify_ranked_cb */
+	struct fp_identify_match *identify_matches;
+	size_t identify_max_matches;
+	size_t identify_nr_matches;
 };
 
 enum fp_imgdev_state {
@@ -151,6 +161,7 @@ enum fp_imgdev_enroll_state {
 	IMG_ACQUIRE_STATE_ACTIVATING,
 	IMG_ACQUIRE_STATE_AWAIT_FINGER_ON,
 	IMG_ACQUIRE_STATE_AWAIT_IMAGE,
+	IMG_ACQUIRE_STATE_PROCESSING,
 	IMG_ACQUIRE_STATE_AWAIT_FINGER_OFF,
 	IMG_ACQUIRE_STATE_DONE,
 	IMG_ACQUIRE_STATE_DEACTIVATING,
@@ -174,6 +185,11 @@ struct fp_img_dev {
 	/* FIXME: better place to put this? */
 	size_t identify_match_offset;
 
+	/* the captured image being processed away from the event loop, and
+	 * whether the finger was removed in the meantime */
+	struct fpi_process_job *process_job;
+	gboolean finger_off_pending;
+
 	void *priv;
 };
 
@@ -181,6 +197,7 @@ int fpi_imgdev_capture(struct fp_img_dev *imgdev, int unconditional,
 	struct fp_img **image);
 int fpi_imgdev_get_img_width(struct fp_img_dev *imgdev);
 int fpi_imgdev_get_img_height(struct fp_img_dev *imgdev);
+void fpi_imgdev_exit(void);
 
 struct usb_id {
 	uint16_t vendor;
@@ -290,15 +307,23 @@ struct fp_dscv_print {
 
 enum fp_print_data_type {
 	PRINT_DATA_RAW = 0, /* memset-imposed default */
-	PRINT_DATA_NBIS_MINUTIAE,
+	PRINT_DATA_NBIS_MINUTIAE, /* struct xyt_struct as is */
+	PRINT_DATA_NBIS_COMPACT, /* the same minutiae, packed (img.c) */
 };
 
+/* Either form of minutiae; prints of the two can be compared with each other */
+#define PRINT_DATA_IS_NBIS(type) \
+	((type) == PRINT_DATA_NBIS_MINUTIAE || (type) == PRINT_DATA_NBIS_COMPACT)
+
 struct fp_print_data {
 	uint16_t driver_id;
 	uint32_t devtype;
 	enum fp_print_data_type type;
+	/* matcher state derived from NBIS prints, built on first use (img.c) */
+	struct bz_web *web;
 	size_t length;
-	unsigned char data[0];
+	/* follows the structure, unless the print is a view (galleryfile.c) */
+	unsigned char *data;
 };
 
 struct fpi_print_data_fp1 {
@@ -311,6 +336,8 @@ struct fpi_print_data_fp1 {
 
 void fpi_data_exit(void);
 struct fp_print_data *fpi_print_data_new(struct fp_dev *dev, size_t length);
+gboolean fpi_print_data_view(struct fp_print_data *data, unsigned char *buf,
+	size_t buflen);
 gboolean fpi_print_data_compatible(uint16_t driver_id1, uint32_t devtype1,
 	enum fp_print_data_type type1, uint16_t driver_id2, uint32_t devtype2,
 	enum fp_print_data_type type2);
@@ -340,6 +367,8 @@ struct fp_img {
 	unsigned char data[0];
 };
 
+void fpi_img_init(void);
+void fpi_img_exit(void);
 struct fp_img *fpi_img_new(size_t length);
 struct fp_img *fpi_img_new_for_imgdev(struct fp_img_dev *dev);
 struct fp_img *fpi_img_resize(struct fp_img *img, size_t newsize);
@@ -348,11 +377,51 @@ int fpi_img_detect_minutiae(struct fp_img *img);
 int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
 	struct fp_print_data **ret);
 int fpi_img_compare_print_data(struct fp_print_data *enrolled_print,
-	struct fp_print_data *new_print);
+	struct fp_print_data *new_print, int match_threshold);
 int fpi_img_compare_print_data_to_gallery(struct fp_print_data *print,
 	struct fp_print_data **gallery, int match_threshold, size_t *match_offset);
+int fpi_img_rank_print_data_in_gallery(struct fp_print_data *print,
+	struct fp_print_data **gallery, int match_threshold,
+	struct fp_identify_match *matches, size_t max_matches, size_t *nr_matches);
+int fpi_print_index_identify(struct fp_print_index *idx,
+	struct fp_print_data *print, int match_threshold, size_t *match_offset);
+struct fp_print_data **fpi_print_index_get_gallery(struct fp_print_index *idx);
+
+struct fp_print_data **fpi_gallery_get_prints(struct fp_gallery *gallery);
+size_t fpi_gallery_get_handle(struct fp_gallery *gallery, size_t offset);
+
+void fpi_img_print_data_free_web(struct fp_print_data *data);
+size_t fpi_img_print_data_web_size(struct fp_print_data *data);
+void fpi_img_print_data_web_write(struct fp_print_data *data,
+	unsigned char *buf);
+void fpi_img_print_data_web_read(struct fp_print_data *data);
+gboolean fpi_img_print_data_is_valid(struct fp_print_data *data);
+struct xyt_struct *fpi_img_print_data_get_xyt(struct fp_print_data *data,
+	struct xyt_struct *buf);
 struct fp_img *fpi_im_resize(struct fp_img *img, unsigned int factor);
 
+/* work spread over a pool of threads, the submitting thread taking part */
+
+struct fpi_work_pool {
+	const char *name;
+	int threads_per_cpu;
+	GMutex lock;
+	GThreadPool *pool;
+	int nthreads;
+	gboolean failed;
+};
+
+#define FPI_WORK_POOL_INIT(name, threads_per_cpu) { (name), (threads_per_cpu) }
+
+typedef void (*fpi_work_fn)(void *data);
+
+struct fpi_work;
+int fpi_work_pool_threads(struct fpi_work_pool *pool);
+struct fpi_work *fpi_work_start(struct fpi_work_pool *pool, int nhelpers,
+	fpi_work_fn fn, void *data);
+void fpi_work_finish(struct fpi_work *work);
+void fpi_work_pool_exit(struct fpi_work_pool *pool);
+
 /* polling and timeouts */
 
 void fpi_poll_init(void);
@@ -364,6 +433,7 @@ struct fpi_timeout;
 struct fpi_timeout *fpi_timeout_add(unsigned int msec, fpi_timeout_fn callback,
 	void *data);
 void fpi_timeout_cancel(struct fpi_timeout *timeout);
+void fpi_poll_defer(fpi_timeout_fn callback, void *data);
 
 /* async drv <--> lib comms */
 
@@ -29,6 +29,9 @@ struct fp_dscv_print;
 struct fp_dev;
 struct fp_driver;
 struct fp_print_data;
+struct fp_print_index;
+struct fp_gallery;
+struct fp_gallery_file;
 struct fp_img;
 
 /* misc/general stuff */
@@ -88,6 +91,8 @@ static inline uint16_t fp_dscv_dev_get_driver_id(struct fp_dscv_dev *dev)
 
 /* Print discovery */
 struct fp_dscv_print **fp_discover_prints(void);
+struct fp_dscv_print **fp_discover_prints_for_devtype(uint16_t driver_id,
+	uint32_t devtype);
 void fp_dscv_prints_free(struct fp_dscv_print **prints);
 uint16_t fp_dscv_print_get_driver_id(struct fp_dscv_print *print);
 uint32_t fp_dscv_print_get_devtype(struct fp_dscv_print *print);
@@ -236,11 +241,34 @@ static inline int fp_identify_finger(struct fp_dev *dev,
 	return fp_identify_finger_img(dev, print_gallery, match_offset, NULL);
 }
 
+/** \ingroup dev
+ * A gallery print which was a candidate in ranked identification.
+ * \sa fp_identify_finger_img_ranked()
+ */
+struct fp_identify_match {
+	/** The index of the print in the print gallery array */
+	size_t offset;
+	/** How well the print matched the scanned finger, never negative.
+	 * Higher is better. */
+	int score;
+};
+
+int fp_identify_finger_img_ranked(struct fp_dev *dev,
+	struct fp_print_data **print_gallery, struct fp_identify_match *matches,
+	size_t max_matches, size_t *nr_matches, struct fp_img **img);
+int fp_identify_finger_img_indexed(struct fp_dev *dev,
+	struct fp_print_index *index, size_t *match_offset, struct fp_img **img);
+int fp_identify_finger_img_gallery(struct fp_dev *dev,
+	struct fp_gallery *gallery, size_t *match_handle, struct fp_img **img);
+
 /* Data handling */
 int fp_print_data_load(struct fp_dev *dev, enum fp_finger finger,
 	struct fp_print_data **data);
 int fp_print_data_from_dscv_print(struct fp_dscv_print *print,
 	struct fp_print_data **data);
+struct fp_print_data **fp_dscv_prints_load(struct fp_dscv_print **prints,
+	int *errors);
+void fp_print_data_gallery_free(struct fp_print_data **gallery);
 int fp_print_data_save(struct fp_print_data *data, enum fp_finger finger);
 int fp_print_data_delete(struct fp_dev *dev, enum fp_finger finger);
 void fp_print_data_free(struct fp_print_data *data);
@@ -249,6 +277,31 @@ struct fp_print_data *fp_print_data_from_data(unsigned char *buf,
 	size_t buflen);
 uint16_t fp_print_data_get_driver_id(struct fp_print_data *data);
 uint32_t fp_print_data_get_devtype(struct fp_print_data *data);
+int fp_print_data_score_matrix(struct fp_print_data **probes,
+	struct fp_print_data **gallery, int *scores);
+
+/* Print indexes */
+struct fp_print_index *fp_print_index_new(struct fp_print_data **gallery);
+void fp_print_index_free(struct fp_print_index *index);
+void fp_print_index_set_penetration(struct fp_print_index *index,
+	unsigned int permille);
+size_t *fp_print_index_search(struct fp_print_index *index,
+	struct fp_print_data *print, size_t *nr_candidates);
+
+/* Galleries */
+struct fp_gallery *fp_gallery_new(void);
+void fp_gallery_free(struct fp_gallery *gallery);
+size_t fp_gallery_add(struct fp_gallery *gallery, struct fp_print_data *print);
+int fp_gallery_remove(struct fp_gallery *gallery, size_t handle);
+struct fp_print_data *fp_gallery_get_print(struct fp_gallery *gallery,
+	size_t handle);
+size_t fp_gallery_get_size(struct fp_gallery *gallery);
+
+/* Gallery files */
+int fp_gallery_file_save(struct fp_print_data **prints, const char *path);
+struct fp_gallery_file *fp_gallery_file_open(const char *path);
+struct fp_print_data **fp_gallery_file_get_prints(struct fp_gallery_file *file);
+void fp_gallery_file_close(struct fp_gallery_file *file);
 
 /* Image handling */
 
@@ -275,6 +328,7 @@ int fp_img_save_to_file(struct fp_img *img, char *path);
 void fp_img_standardize(struct fp_img *img);
 struct fp_img *fp_img_binarize(struct fp_img *img);
 struct fp_minutia **fp_img_get_minutiae(struct fp_img *img, int *nr_minutiae);
+int fp_img_set_max_minutiae(int max);
 void fp_img_free(struct fp_img *img);
 
 /* Polling and timing */
@@ -288,6 +342,8 @@ int fp_handle_events_timeout(struct timeval *timeout);
 int fp_handle_events(void);
 size_t fp_get_pollfds(struct fp_pollfd **pollfds);
 int fp_get_next_timeout(struct timeval *tv);
+int fp_get_event_fd(void);
+int fp_dispatch_events(void);
 
 typedef void (*fp_pollfd_added_cb)(int fd, short events);
 typedef void (*fp_pollfd_removed_cb)(int fd);
@@ -331,6 +387,17 @@ typedef void (*fp_identify_cb)(struct fp_dev *dev, int result,
 	size_t match_offset, struct fp_img *img, void *user_data);
 int fp_async_identify_start(struct fp_dev *dev, struct fp_print_data **gallery,
 	fp_identify_cb callback, void *user_data);
+int fp_async_identify_indexed_start(struct fp_dev *dev,
+	struct fp_print_index *index, fp_identify_cb callback, void *user_data);
+int fp_async_identify_gallery_start(struct fp_dev *dev,
+	struct fp_gallery *gallery, fp_identify_cb callback, void *user_data);
+
+typedef void (*fp_identify_ranked_cb)(struct fp_dev *dev, int result,
+	struct fp_identify_match *matches, size_t nr_matches, struct fp_img *img,
+	void *user_data);
+int fp_async_identify_ranked_start(struct fp_dev *dev,
+	struct fp_print_data **gallery, size_t max_matches,
+	fp_identify_ranked_cb callback, void *user_data);
 
 typedef void (*fp_identify_stop_cb)(struct fp_dev *dev, void *user_data);
 int fp_async_identify_stop(struct fp_dev *dev, fp_identify_stop_cb callback,
@@ -0,0 +1,204 @@
+/*
+ * Print galleries
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "gallery"
+
+#include <config.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "fp_internal.h"
+
+/** @defgroup gallery Print galleries
+ * Identification functions such as fp_identify_finger_img() take the prints
+ * to identify against as an array, which the application has to build again
+ * whenever a finger is enrolled or deleted. A gallery object holds such a
+ * set of prints, and lets prints be added and removed one at a time, without
+ * touching the others.
+ *
+ * Each print added to a gallery is given a handle, which refers to it for as
+ * long as it remains in the gallery, whatever else is added or removed. When
+ * identifying against a gallery with fp_identify_finger_img_gallery() or
+ * fp_async_identify_gallery_start(), the matching print is reported by its
+ * handle.
+ *
+ * The gallery owns the prints added to it. Data the matcher prepares for a
+ * print on first use is kept along with it, so it is not computed again for
+ * later identifications.
+ */
+
+/* Handles which are not in use are marked with this in the slot table */
+#define NO_SLOT ((size_t) -1)
+
+struct fp_gallery {
+	/* NULL-terminated, in the form identification takes a gallery */
+	struct fp_print_data **prints;
+	/* the handle of each print */
+	size_t *handles;
+	size_t len;
+	size_t alloc;
+
+	/* the position in prints of each handle, or NO_SLOT */
+	size_t *slots;
+	size_t nr_handles;
+	/* handles which were given out and are no longer in use */
+	size_t *free_handles;
+	size_t nr_free_handles;
+};
+
+/** \ingroup gallery
+ * Creates a new, empty gallery.
+ * \returns the new gallery. Must be freed with fp_gallery_free() after use.
+ */
+API_EXPORTED struct fp_gallery *fp_gallery_new(void)
+{
+	struct fp_gallery *gallery = g_malloc0(sizeof(*gallery));
+
+	gallery->alloc = 16;
+	gallery->prints = g_new(struct fp_print_data *, gallery->alloc + 1);
+	gallery->prints[0] = NULL;
+	gallery->handles = g_new(size_t, gallery->alloc);
+	gallery->slots = g_new(size_t, gallery->alloc);
+	gallery->free_handles = g_new(size_t, gallery->alloc);
+	return gallery;
+}
+
+/** \ingroup gallery
+ * Frees a gallery, along with all of the prints it holds.
+ * \param gallery the gallery to destroy. If NULL, function simply returns.
+ */
+API_EXPORTED void fp_gallery_free(struct fp_gallery *gallery)
+{
+	size_t i;
+
+	if (!gallery)
+		return;
+
+	for (i = 0; i < gallery->len; i++)
+		fp_print_data_free(gallery->prints[i]);
+	g_free(gallery->prints);
+	g_free(gallery->handles);
+	g_free(gallery->slots);
+	g_free(gallery->free_handles);
+	g_free(gallery);
+}
+
+/** \ingroup gallery
+ * Adds a print to a gallery. The gallery takes ownership of the print, which
+ * must not be freed by the caller; it is freed when removed from the gallery
+ * or when the gallery itself is freed.
+ * \param gallery the gallery
+ * \param print the print to add
+ * \returns the handle of the print in the gallery
+ */
+API_EXPORTED size_t fp_gallery_add(struct fp_gallery *gallery,
+	struct fp_print_data *print)
+{
+	size_t handle;
+
+	/* new handles are only made when all others are in use, so there are
+	 * never more of them than the most prints the gallery has held */
+	if (gallery->len == gallery->alloc) {
+		gallery->alloc *= 2;
+		gallery->prints = g_renew(struct fp_print_data *, gallery->prints,
+			gallery->alloc + 1);
+		gallery->handles = g_renew(size_t, gallery->handles, gallery->alloc);
+		gallery->slots = g_renew(size_t, gallery->slots, gallery->alloc);
+		gallery->free_handles = g_renew(size_t, gallery->free_handles,
+			gallery->alloc);
+	}
+
+	if (gallery->nr_free_handles)
+		handle = gallery->free_handles[--gallery->nr_free_handles];
+	else
+		handle = gallery->nr_handles++;
+
+	gallery->slots[handle] = gallery->len;
+	gallery->handles[gallery->len] = handle;
+	gallery->prints[gallery->len++] = print;
+	gallery->prints[gallery->len] = NULL;
+	return handle;
+}
+
+/** \ingroup gallery
+ * Removes a print from a gallery and frees it. The handle of the print may
+ * be given to a print added later. The handles of other prints are not
+ * affected.
+ * \param gallery the gallery
+ * \param handle the handle of the print to remove
+ * \returns 0 on success, or -EINVAL if no print in the gallery has this
+ * handle
+ */
+API_EXPORTED int fp_gallery_remove(struct fp_gallery *gallery, size_t handle)
+{
+	size_t slot, last;
+
+	if (handle >= gallery->nr_handles || gallery->slots[handle] == NO_SLOT)
+		return -EINVAL;
+
+	/* the last print takes the place of the one going */
+	slot = gallery->slots[handle];
+	last = --gallery->len;
+	fp_print_data_free(gallery->prints[slot]);
+	gallery->prints[slot] = gallery->prints[last];
+	gallery->handles[slot] = gallery->handles[last];
+	gallery->slots[gallery->handles[slot]] = slot;
+	gallery->prints[last] = NULL;
+
+	gallery->slots[handle] = NO_SLOT;
+	gallery->free_handles[gallery->nr_free_handles++] = handle;
+	return 0;
+}
+
+/** \ingroup gallery
+ * Gets a print held in a gallery. The print remains owned by the gallery.
+ * \param gallery the gallery
+ * \param handle the handle of the print
+ * \returns the print, or NULL if no print in the gallery has this handle
+ */
+API_EXPORTED struct fp_print_data *fp_gallery_get_print(
+	struct fp_gallery *gallery, size_t handle)
+{
+	if (handle >= gallery->nr_handles || gallery->slots[handle] == NO_SLOT)
+		return NULL;
+	return gallery->prints[gallery->slots[handle]];
+}
+
+/** \ingroup gallery
+ * Gets the number of prints held in a gallery.
+ * \param gallery the gallery
+ * \returns the number of prints
+ */
+API_EXPORTED size_t fp_gallery_get_size(struct fp_gallery *gallery)
+{
+	return gallery->len;
+}
+
+/* The prints of a gallery, in the form identification takes them. Only
+ * valid until the gallery is next changed. */
+struct fp_print_data **fpi_gallery_get_prints(struct fp_gallery *gallery)
+{
+	return gallery->prints;
+}
+
+/* The handle of the print at an offset into fpi_gallery_get_prints() */
+size_t fpi_gallery_get_handle(struct fp_gallery *gallery, size_t offset)
+{
+	return gallery->handles[offset];
+}
@@ -0,0 +1,255 @@
+/*
+ * Packed gallery files
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "galleryfile"
+
+#include <config.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "fp_internal.h"
+
+/** @defgroup gallery_file Gallery files
+ * Loading a large gallery print by print, each from a file of its own, costs
+ * a file open, a read and a copy per print. A gallery file packs a whole
+ * gallery into a single file, which is mapped into memory when opened: the
+ * prints it holds are then used right where they lie in the file, without
+ * being read or copied at all.
+ *
+ * Write a gallery file with fp_gallery_file_save(), and open it with
+ * fp_gallery_file_open(). fp_gallery_file_get_prints() gives the prints in
+ * the form identification functions such as fp_identify_finger() take a
+ * gallery.
+ */
+
+/* A gallery file starts with this header, followed by nr_prints entries
+ * locating the prints, and then the prints themselves, each one as
+ * fp_print_data_get_data() makes it. All fields are little-endian. */
+#define GALLERY_FILE_VERSION 1
+
+struct fpi_gallery_file_header {
+	char prefix[3];
+	uint8_t version;
+	uint32_t nr_prints;
+} __attribute__((__packed__));
+
+struct fpi_gallery_file_entry {
+	/* from the start of the file */
+	uint64_t offset;
+	uint32_t length;
+} __attribute__((__packed__));
+
+/* Prints are placed so that their payload, which follows the print header,
+ * starts on a boundary this large. Prints in the original minutiae format
+ * are used as a structure of ints right where they lie. */
+#define GALLERY_FILE_ALIGN 8
+
+struct fp_gallery_file {
+	GMappedFile *map;
+	size_t nr_prints;
+	/* views of the prints in the file */
+	struct fp_print_data *views;
+	/* NULL-terminated list of pointers to the views */
+	struct fp_print_data **prints;
+};
+
+static size_t print_offset(size_t end)
+{
+	size_t hdr = sizeof(struct fpi_print_data_fp1);
+	return (end + hdr + GALLERY_FILE_ALIGN - 1) / GALLERY_FILE_ALIGN
+		* GALLERY_FILE_ALIGN - hdr;
+}
+
+/** \ingroup gallery_file
+ * Writes a set of prints to a gallery file, replacing the file if it already
+ * exists. The prints may come from any devices, and in any mix.
+ * \param prints NULL-terminated array of pointers to the prints to write
+ * \param path the file to write
+ * \returns 0 on success, or a negative error code
+ */
+API_EXPORTED int fp_gallery_file_save(struct fp_print_data **prints,
+	const char *path)
+{
+	struct fpi_gallery_file_header *hdr;
+	struct fpi_gallery_file_entry *entries;
+	unsigned char **bufs;
+	size_t *lens;
+	size_t nr_prints = 0;
+	size_t i, end;
+	GError *err = NULL;
+	gchar *contents;
+	int r = 0;
+
+	while (prints[nr_prints])
+		nr_prints++;
+	if (nr_prints > G_MAXUINT32)
+		return -EINVAL;
+
+	bufs = g_new0(unsigned char *, nr_prints);
+	lens = g_new(size_t, nr_prints);
+	end = sizeof(*hdr) + nr_prints * sizeof(*entries);
+	for (i = 0; i < nr_prints; i++) {
+		lens[i] = fp_print_data_get_data(prints[i], &bufs[i]);
+		if (!lens[i] || lens[i] > G_MAXUINT32) {
+			r = -ENOMEM;
+			goto out;
+		}
+		end = print_offset(end) + lens[i];
+	}
+
+	contents = g_malloc0(end);
+	hdr = (struct fpi_gallery_file_header *) contents;
+	hdr->prefix[0] = 'F';
+	hdr->prefix[1] = 'P';
+	hdr->prefix[2] = 'G';
+	hdr->version = GALLERY_FILE_VERSION;
+	hdr->nr_prints = GUINT32_TO_LE(nr_prints);
+
+	entries = (struct fpi_gallery_file_entry *) (hdr + 1);
+	end = sizeof(*hdr) + nr_prints * sizeof(*entries);
+	for (i = 0; i < nr_prints; i++) {
+		size_t offset = print_offset(end);
+
+		entries[i].offset = GUINT64_TO_LE(offset);
+		entries[i].length = GUINT32_TO_LE(lens[i]);
+		memcpy(contents + offset, bufs[i], lens[i]);
+		end = offset + lens[i];
+	}
+
+	fp_dbg("writing %zd prints to %s", nr_prints, path);
+	g_file_set_contents(path, contents, end, &err);
+	g_free(contents);
+	if (err) {
+		fp_err("save failed: %s", err->message);
+		g_error_free(err);
+		r = -EIO;
+	}
+
+out:
+	for (i = 0; i < nr_prints; i++)
+		free(bufs[i]);
+	g_free(bufs);
+	g_free(lens);
+	return r;
+}
+
+/** \ingroup gallery_file
+ * Opens a gallery file written by fp_gallery_file_save().
+ * \param path the file to open
+ * \returns the opened gallery file, or NULL on error. Must be closed with
+ * fp_gallery_file_close() after use.
+ */
+API_EXPORTED struct fp_gallery_file *fp_gallery_file_open(const char *path)
+{
+	struct fp_gallery_file *file;
+	struct fpi_gallery_file_header *hdr;
+	struct fpi_gallery_file_entry *entries;
+	unsigned char *contents;
+	GError *err = NULL;
+	GMappedFile *map;
+	size_t len, nr_prints, i;
+
+	map = g_mapped_file_new(path, FALSE, &err);
+	if (!map) {
+		fp_err("could not map %s: %s", path, err->message);
+		g_error_free(err);
+		return NULL;
+	}
+
+	contents = (unsigned char *) g_mapped_file_get_contents(map);
+	len = g_mapped_file_get_length(map);
+	hdr = (struct fpi_gallery_file_header *) contents;
+	if (len < sizeof(*hdr) || strncmp(hdr->prefix, "FPG", 3) != 0
+			|| hdr->version != GALLERY_FILE_VERSION) {
+		fp_err("%s is not a gallery file", path);
+		g_mapped_file_unref(map);
+		return NULL;
+	}
+
+	nr_prints = GUINT32_FROM_LE(hdr->nr_prints);
+	if (nr_prints > (len - sizeof(*hdr)) / sizeof(*entries)) {
+		fp_err("%s is truncated", path);
+		g_mapped_file_unref(map);
+		return NULL;
+	}
+
+	file = g_malloc0(sizeof(*file));
+	file->map = map;
+	file->views = g_new0(struct fp_print_data, nr_prints);
+	file->prints = g_new(struct fp_print_data *, nr_prints + 1);
+	entries = (struct fpi_gallery_file_entry *) (hdr + 1);
+	for (i = 0; i < nr_prints; i++) {
+		uint64_t offset = GUINT64_FROM_LE(entries[i].offset);
+		uint32_t length = GUINT32_FROM_LE(entries[i].length);
+
+		if (offset > len || length > len - offset
+				|| offset != print_offset(offset)
+				|| !fpi_print_data_view(&file->views[i], contents + offset,
+					length)) {
+			fp_err("print %zd in %s is corrupt", i, path);
+			goto err;
+		}
+		file->prints[i] = &file->views[i];
+		file->nr_prints++;
+	}
+	file->prints[i] = NULL;
+
+	fp_dbg("mapped %zd prints from %s", file->nr_prints, path);
+	return file;
+
+err:
+	fp_gallery_file_close(file);
+	return NULL;
+}
+
+/** \ingroup gallery_file
+ * Gets the prints held in a gallery file, in the order they were written in.
+ * They can be used like any other prints, but remain owned by the gallery
+ * file: they must not be freed with fp_print_data_free(), and are only valid
+ * until the file is closed.
+ * \param file the gallery file
+ * \returns NULL-terminated array of pointers to the prints
+ */
+API_EXPORTED struct fp_print_data **fp_gallery_file_get_prints(
+	struct fp_gallery_file *file)
+{
+	return file->prints;
+}
+
+/** \ingroup gallery_file
+ * Closes a gallery file. The prints it holds can no longer be used.
+ * \param file the gallery file to close. If NULL, function simply returns.
+ */
+API_EXPORTED void fp_gallery_file_close(struct fp_gallery_file *file)
+{
+	size_t i;
+
+	if (!file)
+		return;
+
+	/* matcher data may have been built for the prints while in use */
+	for (i = 0; i < file->nr_prints; i++)
+		fpi_img_print_data_free_web(&file->views[i]);
+	g_free(file->views);
+	g_free(file->prints);
+	g_mapped_file_unref(file->map);
+	g_free(file);
+}
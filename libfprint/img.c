@@ -233,21 +233,72 @@ API_EXPORTED void fp_img_standardize(struct fp_img *img)
 	}
 }
 
-/* Based on write_minutiae_XYTQ and bz_load */
+/* The most minutiae a print made from an image will hold. Every comparison
+ * is quadratic in the number of minutiae, so this is a trade-off between
+ * accuracy and speed. */
+static int max_minutiae = DEFAULT_BOZORTH_MINUTIAE;
+
+/** \ingroup img
+ * Sets the most minutiae that prints made from images from here on will hold.
+ * When more minutiae are detected on an image, only the most reliable ones
+ * are kept. Fewer minutiae make for smaller prints which compare faster,
+ * too few will start to cost accuracy. The default is 150.
+ *
+ * This only affects prints made after the call; prints compared with each
+ * other should preferably have been made with the same setting.
+ *
+ * \param max the most minutiae to keep, from 1 to 200
+ * \returns 0 on success, -EINVAL if max is out of range
+ */
+API_EXPORTED int fp_img_set_max_minutiae(int max)
+{
+	if (max < 1 || max > MAX_BOZORTH_MINUTIAE)
+		return -EINVAL;
+	g_atomic_int_set(&max_minutiae, max);
+	return 0;
+}
+
+/* Orders minutiae indices on decreasing reliability, then on detection
+ * order so that the choice among equally reliable minutiae is stable. */
+static gint cmp_minutia_reliability(gconstpointer a, gconstpointer b,
+	gpointer user_data)
+{
+	struct fp_minutia **list = user_data;
+	int ia = *(const int *) a;
+	int ib = *(const int *) b;
+	double ra = list[ia]->reliability;
+	double rb = list[ib]->reliability;
+
+	if (ra != rb)
+		return ra > rb ? -1 : 1;
+	return ia - ib;
+}
+
+/* Based on write_minutiae_XYTQ and bz_load. Like bz_load, when there are
+ * more minutiae than we keep, the most reliable ones are kept. */
 static void minutiae_to_xyt(struct fp_minutiae *minutiae, int bwidth,
 	int bheight, unsigned char *buf)
 {
 	int i;
 	struct fp_minutia *minutia;
-	struct minutiae_struct c[MAX_FILE_MINUTIAE];
+	struct minutiae_struct c[MAX_BOZORTH_MINUTIAE];
 	struct xyt_struct *xyt = (struct xyt_struct *) buf;
+	int nmin = minutiae->num;
+	int limit = g_atomic_int_get(&max_minutiae);
+	int *order = NULL;
 
-	/* FIXME: only considers first 150 minutiae (MAX_FILE_MINUTIAE) */
-	/* nist does weird stuff with 150 vs 1000 limits */
-	int nmin = min(minutiae->num, MAX_FILE_MINUTIAE);
+	if (nmin > limit) {
+		order = g_new(int, nmin);
+		for (i = 0; i < nmin; i++)
+			order[i] = i;
+		g_qsort_with_data(order, nmin, sizeof(*order),
+			cmp_minutia_reliability, minutiae->list);
+		fp_dbg("keeping %d of %d minutiae", limit, nmin);
+		nmin = limit;
+	}
 
 	for (i = 0; i < nmin; i++){
-		minutia = minutiae->list[i];
+		minutia = minutiae->list[order ? order[i] : i];
 
 		lfs2nist_minutia_XYT(&c[i].col[0], &c[i].col[1], &c[i].col[2],
 				minutia, bwidth, bheight);
@@ -256,6 +307,7 @@ static void minutiae_to_xyt(struct fp_minutiae *minutiae, int bwidth,
 		if (c[i].col[2] > 180)
 			c[i].col[2] -= 360;
 	}
+	g_free(order);
 
 	qsort((void *) &c, (size_t) nmin, sizeof(struct minutiae_struct),
 			sort_x_y);
@@ -268,6 +320,273 @@ static void minutiae_to_xyt(struct fp_minutiae *minutiae, int bwidth,
 	xyt->nrows = nmin;
 }
 
+/* Prints from imaging devices are stored as PRINT_DATA_NBIS_COMPACT. Unlike a
+ * struct xyt_struct this only takes as much room as there are minutiae, and
+ * reads the same on any machine. After a version byte and the number of
+ * minutiae, each minutia takes three unsigned little-endian base 128 values
+ * of one or two bytes: its x offset from the previous minutia (they are
+ * sorted on x), its y, and its theta + 180. */
+#define PRINT_COMPACT_VERSION 1
+#define PRINT_COMPACT_MAX_COORD 0x3fff
+#define PRINT_COMPACT_MAX_SIZE \
+	(sizeof(struct fpi_print_data_compact) + MAX_BOZORTH_MINUTIAE * 3 * 2)
+
+struct fpi_print_data_compact {
+	uint8_t version;
+	uint8_t nrows;
+	unsigned char minutiae[0];
+} __attribute__((__packed__));
+
+static unsigned char *compact_put(unsigned char *out, unsigned int val)
+{
+	if (val < 0x80) {
+		*out++ = val;
+	} else {
+		*out++ = 0x80 | (val & 0x7f);
+		*out++ = val >> 7;
+	}
+	return out;
+}
+
+/* Returns the position after the value, or NULL if it runs past end */
+static const unsigned char *compact_get(const unsigned char *in,
+	const unsigned char *end, int *val)
+{
+	if (in >= end)
+		return NULL;
+	if (!(in[0] & 0x80)) {
+		*val = in[0];
+		return in + 1;
+	}
+	if (in + 1 >= end || (in[1] & 0x80))
+		return NULL;
+	*val = (in[0] & 0x7f) | (in[1] << 7);
+	return in + 2;
+}
+
+/* Packs xyt into buf, which must hold PRINT_COMPACT_MAX_SIZE bytes. Returns
+ * the length used, or 0 if some coordinate is too large to be encoded. */
+static size_t compact_encode(struct xyt_struct *xyt, unsigned char *buf)
+{
+	struct fpi_print_data_compact *raw = (struct fpi_print_data_compact *) buf;
+	unsigned char *out = raw->minutiae;
+	int prev_x = 0;
+	int i;
+
+	raw->version = PRINT_COMPACT_VERSION;
+	raw->nrows = xyt->nrows;
+	for (i = 0; i < xyt->nrows; i++) {
+		int x = xyt->xcol[i];
+		int y = xyt->ycol[i];
+		int theta = xyt->thetacol[i] + 180;
+
+		if (x < prev_x || x > PRINT_COMPACT_MAX_COORD
+				|| y < 0 || y > PRINT_COMPACT_MAX_COORD
+				|| theta < 0 || theta > 360)
+			return 0;
+		out = compact_put(out, x - prev_x);
+		out = compact_put(out, y);
+		out = compact_put(out, theta);
+		prev_x = x;
+	}
+	return out - buf;
+}
+
+static gboolean compact_decode(const unsigned char *buf, size_t len,
+	struct xyt_struct *xyt)
+{
+	const struct fpi_print_data_compact *raw =
+		(const struct fpi_print_data_compact *) buf;
+	const unsigned char *in = raw->minutiae;
+	const unsigned char *end = buf + len;
+	int x = 0;
+	int i;
+
+	if (len < sizeof(*raw) || raw->version != PRINT_COMPACT_VERSION
+			|| raw->nrows > MAX_BOZORTH_MINUTIAE)
+		return FALSE;
+
+	for (i = 0; i < raw->nrows; i++) {
+		int dx, y, theta;
+
+		in = compact_get(in, end, &dx);
+		if (in)
+			in = compact_get(in, end, &y);
+		if (in)
+			in = compact_get(in, end, &theta);
+		if (!in)
+			return FALSE;
+
+		x += dx;
+		if (x > PRINT_COMPACT_MAX_COORD || y > PRINT_COMPACT_MAX_COORD
+				|| theta > 360)
+			return FALSE;
+		xyt->xcol[i] = x;
+		xyt->ycol[i] = y;
+		xyt->thetacol[i] = theta - 180;
+	}
+	xyt->nrows = raw->nrows;
+	return in == end;
+}
+
+/* Minutiae in the original format are taken as they are, but must still lie
+ * within reach of the matcher's tables: offsets between two of them are
+ * squared in an int, and their angles index the angle tables. */
+static gboolean xyt_is_valid(struct xyt_struct *xyt)
+{
+	int i;
+
+	if (xyt->nrows < 0 || xyt->nrows > MAX_BOZORTH_MINUTIAE)
+		return FALSE;
+	for (i = 0; i < xyt->nrows; i++)
+		if (ABS(xyt->xcol[i]) > PRINT_COMPACT_MAX_COORD
+				|| ABS(xyt->ycol[i]) > PRINT_COMPACT_MAX_COORD
+				|| ABS(xyt->thetacol[i]) > 180)
+			return FALSE;
+	return TRUE;
+}
+
+/* Checks that a print freshly loaded by fp_print_data_from_data() can be
+ * handed to the matcher. */
+gboolean fpi_img_print_data_is_valid(struct fp_print_data *data)
+{
+	struct xyt_struct xyt;
+
+	switch (data->type) {
+	case PRINT_DATA_NBIS_MINUTIAE:
+		/* anything after the minutiae is carried along untouched */
+		if (data->length < sizeof(xyt))
+			return FALSE;
+		memcpy(&xyt, data->data, sizeof(xyt));
+		return xyt_is_valid(&xyt);
+	case PRINT_DATA_NBIS_COMPACT:
+		return compact_decode(data->data, data->length, &xyt);
+	default:
+		return TRUE;
+	}
+}
+
+/* Returns the minutiae of a print from an imaging device, as the matcher
+ * takes them. Prints in the original format hold exactly that and are used
+ * in place, compact ones are decoded into buf. Returns NULL for any other
+ * kind of print. */
+struct xyt_struct *fpi_img_print_data_get_xyt(struct fp_print_data *data,
+	struct xyt_struct *buf)
+{
+	if (data->type == PRINT_DATA_NBIS_MINUTIAE)
+		return (struct xyt_struct *) data->data;
+	if (data->type == PRINT_DATA_NBIS_COMPACT
+			&& compact_decode(data->data, data->length, buf))
+		return buf;
+	fp_err("invalid print format");
+	return NULL;
+}
+
+/* The lookup tables mindtct works with only depend on the dimensions of the
+ * image, which for most devices are the same every time, so released tables
+ * are kept for reuse. Swipe devices make images of varying heights, hence
+ * the limit on how many are kept. */
+#define LFS_TABLES_POOL_SIZE 4
+
+G_LOCK_DEFINE_STATIC(lfs_tables_pool);
+static GSList *lfs_tables_pool = NULL;
+
+static LFSTABLES *lfs_tables_get(int width, int height)
+{
+	LFSTABLES *tables = NULL;
+	GSList *elem;
+	int r;
+
+	G_LOCK(lfs_tables_pool);
+	for (elem = lfs_tables_pool; elem; elem = g_slist_next(elem)) {
+		LFSTABLES *t = elem->data;
+		if (t->iw == width && t->ih == height) {
+			tables = t;
+			lfs_tables_pool = g_slist_delete_link(lfs_tables_pool, elem);
+			break;
+		}
+	}
+	G_UNLOCK(lfs_tables_pool);
+
+	if (!tables) {
+		fp_dbg("building tables for %dx%d images", width, height);
+		r = init_lfs_tables(&tables, width, height, &lfsparms_V2);
+		if (r) {
+			fp_err("could not build minutiae detection tables, code %d", r);
+			return NULL;
+		}
+	}
+	return tables;
+}
+
+static void lfs_tables_put(LFSTABLES *tables)
+{
+	GSList *stale = NULL;
+	GSList *last;
+
+	G_LOCK(lfs_tables_pool);
+	lfs_tables_pool = g_slist_prepend(lfs_tables_pool, tables);
+	last = g_slist_nth(lfs_tables_pool, LFS_TABLES_POOL_SIZE - 1);
+	if (last) {
+		stale = last->next;
+		last->next = NULL;
+	}
+	G_UNLOCK(lfs_tables_pool);
+
+	g_slist_foreach(stale, (GFunc) free_lfs_tables, NULL);
+	g_slist_free(stale);
+}
+
+/* Minutiae detection spreads the analysis of image blocks over this pool,
+ * through the runner installed in mindtct by fpi_img_init(). The calling
+ * thread works through the tasks too, so a detection always makes progress
+ * even when the pool is busy with others. */
+struct lfs_job {
+	LFS_TASK task;
+	void *arg;
+	int ntasks;
+	gint next;
+};
+
+static struct fpi_work_pool lfs_pool = FPI_WORK_POOL_INIT("detection", 1);
+
+static void lfs_job_run(void *data)
+{
+	struct lfs_job *job = data;
+	int i;
+
+	while ((i = g_atomic_int_add(&job->next, 1)) < job->ntasks)
+		job->task(job->arg, i);
+}
+
+static void lfs_run_tasks(LFS_TASK task, void *arg, const int ntasks)
+{
+	struct lfs_job job;
+	struct fpi_work *work;
+	int nthreads;
+
+	job.task = task;
+	job.arg = arg;
+	job.ntasks = ntasks;
+	job.next = 0;
+
+	nthreads = fpi_work_pool_threads(&lfs_pool);
+	if (nthreads == 0 || ntasks < 2) {
+		lfs_job_run(&job);
+		return;
+	}
+
+	work = fpi_work_start(&lfs_pool, MIN(nthreads, ntasks - 1),
+		lfs_job_run, &job);
+	lfs_job_run(&job);
+	fpi_work_finish(work);
+}
+
+void fpi_img_init(void)
+{
+	set_lfs_runner(lfs_run_tasks);
+}
+
 int fpi_img_detect_minutiae(struct fp_img *img)
 {
 	struct fp_minutiae *minutiae;
@@ -277,6 +596,7 @@ int fpi_img_detect_minutiae(struct fp_img *img)
 	int map_w, map_h;
 	unsigned char *bdata;
 	int bw, bh, bd;
+	LFSTABLES *tables;
 	GTimer *timer;
 
 	if (img->flags & FP_IMG_STANDARDIZATION_FLAGS) {
@@ -286,11 +606,17 @@ int fpi_img_detect_minutiae(struct fp_img *img)
 
 	/* 25.4 mm per inch */
 	timer = g_timer_new();
+	tables = lfs_tables_get(img->width, img->height);
+	if (!tables) {
+		g_timer_destroy(timer);
+		return -ENOMEM;
+	}
 	r = get_minutiae(&minutiae, &quality_map, &direction_map,
                          &low_contrast_map, &low_flow_map, &high_curve_map,
                          &map_w, &map_h, &bdata, &bw, &bh, &bd,
                          img->data, img->width, img->height, 8,
-						 DEFAULT_PPI / (double)25.4, &lfsparms_V2);
+						 DEFAULT_PPI / (double)25.4, &lfsparms_V2, tables);
+	lfs_tables_put(tables);
 	g_timer_stop(timer);
 	fp_dbg("minutiae scan completed in %f secs", g_timer_elapsed(timer, NULL));
 	g_timer_destroy(timer);
@@ -314,6 +640,9 @@ int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
 	struct fp_print_data **ret)
 {
 	struct fp_print_data *print;
+	struct xyt_struct xyt;
+	unsigned char buf[PRINT_COMPACT_MAX_SIZE];
+	size_t len;
 	int r;
 
 	if (!img->minutiae) {
@@ -326,63 +655,835 @@ int fpi_img_to_print_data(struct fp_img_dev *imgdev, struct fp_img *img,
 		}
 	}
 
-	/* FIXME: space is wasted if we dont hit the max minutiae count. would
-	 * be good to make this dynamic. */
-	print = fpi_print_data_new(imgdev->dev, sizeof(struct xyt_struct));
-	print->type = PRINT_DATA_NBIS_MINUTIAE;
-	minutiae_to_xyt(img->minutiae, img->width, img->height, print->data);
-
-	/* FIXME: the print buffer at this point is endian-specific, and will
-	 * only work when loaded onto machines with identical endianness. not good!
-	 * data format should be platform-independent. */
+	minutiae_to_xyt(img->minutiae, img->width, img->height,
+		(unsigned char *) &xyt);
+	len = compact_encode(&xyt, buf);
+	if (len) {
+		print = fpi_print_data_new(imgdev->dev, len);
+		print->type = PRINT_DATA_NBIS_COMPACT;
+		memcpy(print->data, buf, len);
+	} else {
+		/* an image too large for the compact encoding; the original
+		 * format still works on this machine at least */
+		fp_dbg("minutiae out of compact range, storing them as is");
+		print = fpi_print_data_new(imgdev->dev, sizeof(xyt));
+		print->type = PRINT_DATA_NBIS_MINUTIAE;
+		memcpy(print->data, &xyt, sizeof(xyt));
+	}
 	*ret = print;
 
 	return 0;
 }
 
+/* Bozorth3 matcher contexts are tens of megabytes in size, so rather than
+ * allocating one for every comparison we keep released contexts around for
+ * reuse. Each match in progress holds its own context, which is what allows
+ * several of them to run at once. Only a few are kept: beyond that, the
+ * memory held would cost more than the allocations saved. */
+#define BZ_CTX_POOL_SIZE 4
+
+G_LOCK_DEFINE_STATIC(bz_ctx_pool);
+static GSList *bz_ctx_pool = NULL;
+static int bz_ctx_pool_len = 0;
+
+static struct bz_ctx *bz_ctx_get(void)
+{
+	struct bz_ctx *ctx = NULL;
+
+	G_LOCK(bz_ctx_pool);
+	if (bz_ctx_pool) {
+		ctx = bz_ctx_pool->data;
+		bz_ctx_pool = g_slist_delete_link(bz_ctx_pool, bz_ctx_pool);
+		bz_ctx_pool_len--;
+	}
+	G_UNLOCK(bz_ctx_pool);
+
+	if (!ctx)
+		ctx = bz_ctx_new();
+	if (!ctx)
+		fp_err("could not allocate matcher context");
+	return ctx;
+}
+
+static void bz_ctx_put(struct bz_ctx *ctx)
+{
+	G_LOCK(bz_ctx_pool);
+	if (bz_ctx_pool_len < BZ_CTX_POOL_SIZE) {
+		bz_ctx_pool = g_slist_prepend(bz_ctx_pool, ctx);
+		bz_ctx_pool_len++;
+		ctx = NULL;
+	}
+	G_UNLOCK(bz_ctx_pool);
+
+	if (ctx)
+		bz_ctx_free(ctx);
+}
+
+/* Enrolled prints are typically matched many times over (every identify
+ * walks the whole gallery), so the part of the Bozorth3 web that depends
+ * only on the enrolled print is built once and kept on the print. Two
+ * threads may race to build it; the loser throws its copy away. Returns
+ * NULL if the web could not be built, in which case the caller should fall
+ * back on rebuilding it for every comparison. */
+static struct bz_web *print_data_get_web(struct fp_print_data *data,
+	struct bz_ctx *ctx)
+{
+	struct bz_web *web = g_atomic_pointer_get(&data->web);
+	struct xyt_struct buf, *xyt;
+
+	if (web)
+		return web;
+
+	xyt = fpi_img_print_data_get_xyt(data, &buf);
+	if (!xyt)
+		return NULL;
+	web = bozorth_web_new(ctx, xyt);
+	if (!web)
+		return NULL;
+
+	if (!g_atomic_pointer_compare_and_exchange(&data->web, NULL, web)) {
+		bozorth_web_free(web);
+		web = g_atomic_pointer_get(&data->web);
+	}
+	return web;
+}
+
+void fpi_img_print_data_free_web(struct fp_print_data *data)
+{
+	if (data->web)
+		bozorth_web_free(data->web);
+	data->web = NULL;
+}
+
+/* Serialized form of a print's web, appended to the NBIS print payload by
+ * fp_print_data_get_data(). All values fit in 16 bits: distances are squared
+ * and bounded by DM*DM, angles lie within (-180,580] and point indices are
+ * at most MAX_BOZORTH_MINUTIAE. Readers which do not know about it simply
+ * carry it along as part of the payload. Compact prints go without: their web
+ * would be many times their own size, and takes well under a millisecond to
+ * build on first use. */
+#define PRINT_WEB_VERSION 1
+
+struct fpi_print_data_web {
+	char prefix[3];
+	uint8_t version;
+	uint32_t nrows;
+	/* nrows * COLS_SIZE_2 little-endian int16 values */
+	unsigned char rows[0];
+} __attribute__((__packed__));
+
+static size_t print_web_size(struct bz_web *web)
+{
+	return sizeof(struct fpi_print_data_web)
+		+ web->nrows * COLS_SIZE_2 * sizeof(int16_t);
+}
+
+/* Returns the size of the web section that fpi_img_print_data_web_write()
+ * would append to the payload of this print, building the web first if
+ * need be. Returns 0 if there is nothing to append. */
+size_t fpi_img_print_data_web_size(struct fp_print_data *data)
+{
+	struct bz_web *web;
+	struct bz_ctx *ctx;
+
+	if (data->type != PRINT_DATA_NBIS_MINUTIAE
+			|| data->length != sizeof(struct xyt_struct))
+		return 0;
+
+	web = g_atomic_pointer_get(&data->web);
+	if (!web) {
+		ctx = bz_ctx_get();
+		if (!ctx)
+			return 0;
+		web = print_data_get_web(data, ctx);
+		bz_ctx_put(ctx);
+		if (!web)
+			return 0;
+	}
+
+	return print_web_size(web);
+}
+
+void fpi_img_print_data_web_write(struct fp_print_data *data,
+	unsigned char *buf)
+{
+	struct fpi_print_data_web *raw = (struct fpi_print_data_web *) buf;
+	struct bz_web *web = data->web;
+	unsigned char *out = raw->rows;
+	int i, j;
+
+	raw->prefix[0] = 'B';
+	raw->prefix[1] = 'Z';
+	raw->prefix[2] = 'W';
+	raw->version = PRINT_WEB_VERSION;
+	raw->nrows = GUINT32_TO_LE(web->nrows);
+	for (i = 0; i < web->nrows; i++) {
+		for (j = 0; j < COLS_SIZE_2; j++) {
+			int16_t val = GINT16_TO_LE(web->cols[i][j]);
+			memcpy(out, &val, sizeof(val));
+			out += sizeof(val);
+		}
+	}
+}
+
+/* Checks that a stored row could have come out of bz_comp() for a print
+ * with npoints minutiae, so that a corrupt file cannot send the matcher
+ * outside its tables. */
+static gboolean print_web_row_is_sane(const bz_tab_t *row, int npoints)
+{
+	int theta = row[5] >= 220 ? row[5] - 400 : row[5];
+
+	return row[0] >= 0 && row[0] <= DM * DM
+		&& row[1] >= -180 && row[1] <= row[2] && row[2] <= 180
+		&& row[3] >= 1 && row[3] < row[4] && row[4] <= npoints
+		&& theta >= -180 && theta <= 180;
+}
+
+/* Called on a print freshly loaded by fp_print_data_from_data(). If the
+ * payload carries a web section, it is split off and attached to the print.
+ * Sections we cannot use are dropped, the web then gets rebuilt on first
+ * use as usual. */
+void fpi_img_print_data_web_read(struct fp_print_data *data)
+{
+	struct xyt_struct *xyt = (struct xyt_struct *) data->data;
+	struct fpi_print_data_web *raw;
+	struct bz_web *web;
+	size_t len;
+	uint32_t nrows;
+	int npoints;
+	unsigned char *in;
+	int i, j;
+
+	if (data->type != PRINT_DATA_NBIS_MINUTIAE
+			|| data->length <= sizeof(struct xyt_struct))
+		return;
+
+	raw = (struct fpi_print_data_web *) (data->data + sizeof(*xyt));
+	len = data->length - sizeof(*xyt);
+	if (len < sizeof(*raw) || strncmp(raw->prefix, "BZW", 3) != 0) {
+		fp_dbg("unrecognised data after minutiae, ignoring");
+		return;
+	}
+
+	/* from here on the trailing data is ours, whether we can use it or not */
+	data->length = sizeof(*xyt);
+	/* the payload may be a view into a caller's buffer, with no alignment */
+	memcpy(&npoints, &xyt->nrows, sizeof(npoints));
+
+	nrows = GUINT32_FROM_LE(raw->nrows);
+	if (raw->version != PRINT_WEB_VERSION || nrows > FCOLPT_SIZE
+			|| len != sizeof(*raw) + nrows * COLS_SIZE_2 * sizeof(int16_t)
+			|| npoints < 0 || npoints > MAX_BOZORTH_MINUTIAE) {
+		fp_dbg("unusable web section (version %d, %u rows), dropping",
+			raw->version, nrows);
+		return;
+	}
+
+	web = bozorth_web_alloc(nrows);
+	if (!web)
+		return;
+
+	in = raw->rows;
+	for (i = 0; i < nrows; i++) {
+		for (j = 0; j < COLS_SIZE_2; j++) {
+			int16_t val;
+			memcpy(&val, in, sizeof(val));
+			web->cols[i][j] = (int16_t) GINT16_FROM_LE(val);
+			in += sizeof(val);
+		}
+		if (!print_web_row_is_sane(web->cols[i], npoints)) {
+			fp_dbg("corrupt web row %d, dropping", i);
+			bozorth_web_free(web);
+			return;
+		}
+	}
+
+	fpi_img_print_data_free_web(data);
+	data->web = web;
+}
+
+/* Compares the probe already loaded into ctx with an enrolled print. With a
+ * positive threshold, matching stops as soon as the score is known to be on
+ * one side of it, and the score returned is only good for comparing against
+ * that threshold. */
+static int compare_to_enrolled(struct bz_ctx *ctx, int probe_len,
+	struct xyt_struct *pstruct, struct fp_print_data *enrolled_print,
+	int threshold)
+{
+	struct xyt_struct buf;
+	struct xyt_struct *gstruct = fpi_img_print_data_get_xyt(enrolled_print,
+		&buf);
+	struct bz_web *web;
+
+	if (!gstruct)
+		return -EINVAL;
+
+	web = print_data_get_web(enrolled_print, ctx);
+	if (web)
+		return bozorth_to_gallery_web_threshold(ctx, probe_len, pstruct,
+			gstruct, web, threshold);
+	return bozorth_to_gallery_threshold(ctx, probe_len, pstruct, gstruct,
+		threshold);
+}
+
+/* Returns a score which is at or above match_threshold exactly when the full
+ * bozorth3 score would be; pass 0 for the full score itself. */
 int fpi_img_compare_print_data(struct fp_print_data *enrolled_print,
-	struct fp_print_data *new_print)
+	struct fp_print_data *new_print, int match_threshold)
 {
-	struct xyt_struct *gstruct = (struct xyt_struct *) enrolled_print->data;
-	struct xyt_struct *pstruct = (struct xyt_struct *) new_print->data;
+	struct xyt_struct buf;
+	struct xyt_struct *pstruct;
+	struct bz_ctx *ctx;
 	GTimer *timer;
+	int probe_len;
 	int r;
 
-	if (enrolled_print->type != PRINT_DATA_NBIS_MINUTIAE ||
-			new_print->type != PRINT_DATA_NBIS_MINUTIAE) {
+	if (!PRINT_DATA_IS_NBIS(enrolled_print->type)) {
 		fp_err("invalid print format");
 		return -EINVAL;
 	}
+	pstruct = fpi_img_print_data_get_xyt(new_print, &buf);
+	if (!pstruct)
+		return -EINVAL;
+
+	ctx = bz_ctx_get();
+	if (!ctx)
+		return -ENOMEM;
 
 	timer = g_timer_new();
-	r = bozorth_main(pstruct, gstruct);
+	probe_len = bozorth_probe_init(ctx, pstruct);
+	r = compare_to_enrolled(ctx, probe_len, pstruct, enrolled_print,
+		match_threshold);
 	g_timer_stop(timer);
 	fp_dbg("bozorth processing took %f seconds, score=%d",
 		g_timer_elapsed(timer, NULL), r);
 	g_timer_destroy(timer);
 
+	bz_ctx_put(ctx);
 	return r;
 }
 
+/* Work spread over the matching pool. Every thread taking part, the caller
+ * included, calls run() with a matcher context of its own, and run() returns
+ * once there is nothing left for it to claim. */
+struct match_job {
+	void (*run)(struct match_job *job, struct bz_ctx *ctx);
+};
+
+static struct fpi_work_pool match_pool = FPI_WORK_POOL_INIT("matching", 1);
+
+static void match_helper(void *data)
+{
+	struct match_job *job = data;
+	struct bz_ctx *ctx = bz_ctx_get();
+
+	/* if we could not get a context, the remaining workers (including the
+	 * calling thread) simply pick up our share */
+	if (ctx) {
+		job->run(job, ctx);
+		bz_ctx_put(ctx);
+	}
+}
+
+/* Runs a job on the calling thread with ctx, helped by up to nthreads
+ * threads from the matching pool, and waits for all of them to be done
+ * with it. */
+static void match_job_run(struct match_job *job, struct bz_ctx *ctx,
+	int nthreads)
+{
+	struct fpi_work *work = NULL;
+
+	if (nthreads > 0)
+		work = fpi_work_start(&match_pool, nthreads, match_helper, job);
+
+	job->run(job, ctx);
+
+	if (work)
+		fpi_work_finish(work);
+}
+
+/* Galleries are sharded into chunks of this many prints, which workers claim
+ * in ascending order. Small enough to balance well, large enough that the
+ * shared counter is not contended. */
+#define IDENTIFY_CHUNK_SIZE 64
+
+/* A bounded min-heap holding the best candidates seen so far, the worst of
+ * them at the root so that it is the one to go when a better one comes
+ * along. Storage is provided up front, so that pushing never allocates. */
+struct identify_heap {
+	struct fp_identify_match *m;
+	size_t len;
+	size_t max;
+};
+
+/* Lower scores rank worse; among equal scores, later gallery offsets do, so
+ * that the order does not depend on which thread saw which print first. */
+static gboolean match_is_worse(const struct fp_identify_match *a,
+	const struct fp_identify_match *b)
+{
+	return a->score < b->score
+		|| (a->score == b->score && a->offset > b->offset);
+}
+
+static void heap_sift_down(struct fp_identify_match *m, size_t len, size_t i)
+{
+	for (;;) {
+		size_t worst = i;
+		size_t child = 2 * i + 1;
+		struct fp_identify_match tmp;
+
+		if (child < len && match_is_worse(&m[child], &m[worst]))
+			worst = child;
+		if (child + 1 < len && match_is_worse(&m[child + 1], &m[worst]))
+			worst = child + 1;
+		if (worst == i)
+			return;
+
+		tmp = m[i];
+		m[i] = m[worst];
+		m[worst] = tmp;
+		i = worst;
+	}
+}
+
+static void heap_push(struct identify_heap *heap,
+	const struct fp_identify_match *cand)
+{
+	struct fp_identify_match *m = heap->m;
+	size_t i;
+
+	if (heap->len == heap->max) {
+		if (match_is_worse(cand, &m[0]))
+			return;
+		m[0] = *cand;
+		heap_sift_down(m, heap->len, 0);
+		return;
+	}
+
+	i = heap->len++;
+	while (i > 0 && match_is_worse(cand, &m[(i - 1) / 2])) {
+		m[i] = m[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	m[i] = *cand;
+}
+
+/* Turns the heap into an array ordered best candidate first */
+static void heap_sort(struct identify_heap *heap)
+{
+	size_t len = heap->len;
+
+	while (len > 1) {
+		struct fp_identify_match tmp = heap->m[0];
+		heap->m[0] = heap->m[--len];
+		heap->m[len] = tmp;
+		heap_sift_down(heap->m, len, 0);
+	}
+}
+
+struct identify_job {
+	struct match_job base;
+	struct xyt_struct *pstruct;
+	/* the probe's minutiae, if they had to be decoded */
+	struct xyt_struct pbuf;
+	struct bz_ctx *probe_ctx;
+	int probe_len;
+	struct fp_print_data **gallery;
+	gint gallery_len;
+	int match_threshold;
+
+	/* offset of the next unclaimed chunk */
+	volatile gint next;
+	/* lowest matching offset found so far, or gallery_len if none */
+	volatile gint match;
+
+	/* ranked identification only: one bounded heap per participating
+	 * thread, each thread claiming the next free one */
+	size_t max_matches;
+	struct identify_heap *heaps;
+	volatile gint next_heap;
+
+};
+
+static void identify_record_match(struct identify_job *job, gint offset)
+{
+	gint cur;
+
+	do {
+		cur = g_atomic_int_get(&job->match);
+		if (offset >= cur)
+			return;
+	} while (!g_atomic_int_compare_and_exchange(&job->match, cur, offset));
+}
+
+/* Claims chunks until the gallery is exhausted. Prints after the lowest known
+ * match are skipped, but every print before it is still compared, so the
+ * final result is the same first match a sequential walk would find. */
+static void identify_run_first(struct identify_job *job, struct bz_ctx *ctx)
+{
+	gint start;
+
+	while ((start = g_atomic_int_add(&job->next, IDENTIFY_CHUNK_SIZE))
+			< g_atomic_int_get(&job->match)) {
+		gint end = MIN(start + IDENTIFY_CHUNK_SIZE, job->gallery_len);
+		gint i;
+
+		for (i = start; i < end; i++) {
+			int score;
+
+			if (i >= g_atomic_int_get(&job->match))
+				break;
+
+			score = compare_to_enrolled(ctx, job->probe_len, job->pstruct,
+				job->gallery[i], job->match_threshold);
+			if (score >= job->match_threshold) {
+				identify_record_match(job, i);
+				break;
+			}
+		}
+	}
+}
+
+/* Claims chunks until the gallery is exhausted, keeping the best scores this
+ * thread has seen in a heap of its own. Prints which cannot be compared are
+ * no candidates at all. */
+static void identify_run_ranked(struct identify_job *job, struct bz_ctx *ctx)
+{
+	struct identify_heap *heap =
+		&job->heaps[g_atomic_int_add(&job->next_heap, 1)];
+	gint start;
+
+	while ((start = g_atomic_int_add(&job->next, IDENTIFY_CHUNK_SIZE))
+			< job->gallery_len) {
+		gint end = MIN(start + IDENTIFY_CHUNK_SIZE, job->gallery_len);
+		gint i;
+
+		for (i = start; i < end; i++) {
+			struct fp_identify_match cand;
+
+			cand.offset = i;
+			cand.score = compare_to_enrolled(ctx, job->probe_len,
+				job->pstruct, job->gallery[i], 0);
+			if (cand.score < 0)
+				continue;
+			heap_push(heap, &cand);
+		}
+	}
+}
+
+static void identify_run(struct match_job *base, struct bz_ctx *ctx)
+{
+	struct identify_job *job = (struct identify_job *) base;
+
+	bozorth_probe_share(ctx, job->probe_ctx);
+	if (job->heaps)
+		identify_run_ranked(job, ctx);
+	else
+		identify_run_first(job, ctx);
+}
+
+void fpi_img_exit(void)
+{
+	fpi_work_pool_exit(&match_pool);
+
+	set_lfs_runner(NULL);
+	fpi_work_pool_exit(&lfs_pool);
+
+	G_LOCK(lfs_tables_pool);
+	g_slist_foreach(lfs_tables_pool, (GFunc) free_lfs_tables, NULL);
+	g_slist_free(lfs_tables_pool);
+	lfs_tables_pool = NULL;
+	G_UNLOCK(lfs_tables_pool);
+
+	G_LOCK(bz_ctx_pool);
+	g_slist_foreach(bz_ctx_pool, (GFunc) bz_ctx_free, NULL);
+	g_slist_free(bz_ctx_pool);
+	bz_ctx_pool = NULL;
+	bz_ctx_pool_len = 0;
+	G_UNLOCK(bz_ctx_pool);
+}
+
+/* Runs an identification job over the whole gallery, spreading the work
+ * over the identification pool when the gallery is large enough. */
+static int identify_job_run(struct identify_job *job,
+	struct fp_print_data *print, struct fp_print_data **gallery)
+{
+	struct fp_identify_match *heap_storage = NULL;
+	struct bz_ctx *ctx;
+	GTimer *timer;
+	int nthreads = 0;
+	int i;
+
+	job->pstruct = fpi_img_print_data_get_xyt(print, &job->pbuf);
+	if (!job->pstruct)
+		return -EINVAL;
+	job->gallery = gallery;
+	while (gallery[job->gallery_len])
+		job->gallery_len++;
+	job->match = job->gallery_len;
+
+	ctx = bz_ctx_get();
+	if (!ctx)
+		return -ENOMEM;
+
+	timer = g_timer_new();
+	job->probe_ctx = ctx;
+	job->probe_len = bozorth_probe_init(ctx, job->pstruct);
+
+	/* only bother with helper threads when there is more than one chunk */
+	if (job->gallery_len > IDENTIFY_CHUNK_SIZE)
+		nthreads = fpi_work_pool_threads(&match_pool);
+	nthreads = MIN(nthreads,
+		(job->gallery_len - 1) / IDENTIFY_CHUNK_SIZE);
+
+	if (job->max_matches) {
+		heap_storage = g_new(struct fp_identify_match,
+			(nthreads + 1) * job->max_matches);
+		job->heaps = g_new0(struct identify_heap, nthreads + 1);
+		for (i = 0; i <= nthreads; i++) {
+			job->heaps[i].m = heap_storage + i * job->max_matches;
+			job->heaps[i].max = job->max_matches;
+		}
+	}
+
+	job->base.run = identify_run;
+	match_job_run(&job->base, ctx, nthreads);
+
+	g_timer_stop(timer);
+	fp_dbg("identification over %d prints with %d helper threads took %f "
+		"seconds", job->gallery_len, nthreads, g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+
+	/* the helpers are done with the probe web, so the context can go back */
+	bz_ctx_put(ctx);
+
+	/* fold every thread's candidates into the first heap */
+	if (job->heaps) {
+		for (i = 1; i <= nthreads; i++) {
+			size_t j;
+			for (j = 0; j < job->heaps[i].len; j++)
+				heap_push(&job->heaps[0], &job->heaps[i].m[j]);
+		}
+		heap_sort(&job->heaps[0]);
+	}
+
+	return 0;
+}
+
 int fpi_img_compare_print_data_to_gallery(struct fp_print_data *print,
 	struct fp_print_data **gallery, int match_threshold, size_t *match_offset)
 {
-	struct xyt_struct *pstruct = (struct xyt_struct *) print->data;
-	struct fp_print_data *gallery_print;
-	int probe_len = bozorth_probe_init(pstruct);
-	size_t i = 0;
-
-	while ((gallery_print = gallery[i++])) {
-		struct xyt_struct *gstruct = (struct xyt_struct *) gallery_print->data;
-		int r = bozorth_to_gallery(probe_len, pstruct, gstruct);
-		if (r >= match_threshold) {
-			*match_offset = i - 1;
-			return FP_VERIFY_MATCH;
-		}
+	struct identify_job job;
+	int r;
+
+	memset(&job, 0, sizeof(job));
+	job.match_threshold = match_threshold;
+
+	r = identify_job_run(&job, print, gallery);
+	if (r < 0)
+		return r;
+
+	if (job.match < job.gallery_len) {
+		*match_offset = job.match;
+		return FP_VERIFY_MATCH;
 	}
 	return FP_VERIFY_NO_MATCH;
 }
 
+/* Compares the print with every print in the gallery, and returns the best
+ * scoring max_matches of them in matches, best first, leaving out prints
+ * which cannot be compared. The result code tells whether the best of them
+ * scored at or above match_threshold. */
+int fpi_img_rank_print_data_in_gallery(struct fp_print_data *print,
+	struct fp_print_data **gallery, int match_threshold,
+	struct fp_identify_match *matches, size_t max_matches, size_t *nr_matches)
+{
+	struct identify_job job;
+	size_t nr;
+	int r;
+
+	memset(&job, 0, sizeof(job));
+	job.match_threshold = match_threshold;
+	job.max_matches = max_matches;
+
+	*nr_matches = 0;
+	r = identify_job_run(&job, print, gallery);
+	if (r < 0)
+		return r;
+
+	nr = job.heaps[0].len;
+	memcpy(matches, job.heaps[0].m, nr * sizeof(*matches));
+	g_free(job.heaps[0].m);
+	g_free(job.heaps);
+	*nr_matches = nr;
+
+	if (nr > 0 && matches[0].score >= match_threshold)
+		return FP_VERIFY_MATCH;
+	return FP_VERIFY_NO_MATCH;
+}
+
+/* Score matrices are split into tiles of this many probes by this many
+ * gallery prints, so that the webs one tile needs stay in cache while it is
+ * worked on. */
+#define SCORE_TILE_SIZE 8
+
+struct score_matrix_job {
+	struct match_job base;
+	struct fp_print_data **probes;
+	gint nr_probes;
+	struct fp_print_data **gallery;
+	gint gallery_len;
+	int *scores;
+
+	/* tiles are numbered row by row, a row of tiles spanning the gallery */
+	gint tiles_per_row;
+	gint nr_tiles;
+	/* next unclaimed print while building webs, then tile while scoring */
+	volatile gint next;
+	/* set if memory ran out while building a web */
+	volatile gint failed;
+};
+
+static struct fp_print_data *score_matrix_print(struct score_matrix_job *job,
+	gint i)
+{
+	return i < job->nr_probes ? job->probes[i]
+		: job->gallery[i - job->nr_probes];
+}
+
+/* Builds the web of every print involved, probes and gallery alike, so that
+ * scoring never has to build one again. */
+static void score_matrix_prepare(struct match_job *base, struct bz_ctx *ctx)
+{
+	struct score_matrix_job *job = (struct score_matrix_job *) base;
+	gint total = job->nr_probes + job->gallery_len;
+	gint i;
+
+	while ((i = g_atomic_int_add(&job->next, 1)) < total)
+		if (!print_data_get_web(score_matrix_print(job, i), ctx))
+			g_atomic_int_set(&job->failed, 1);
+}
+
+static void score_matrix_run(struct match_job *base, struct bz_ctx *ctx)
+{
+	struct score_matrix_job *job = (struct score_matrix_job *) base;
+	gint tile;
+
+	while ((tile = g_atomic_int_add(&job->next, 1)) < job->nr_tiles) {
+		gint p0 = (tile / job->tiles_per_row) * SCORE_TILE_SIZE;
+		gint g0 = (tile % job->tiles_per_row) * SCORE_TILE_SIZE;
+		gint p_end = MIN(p0 + SCORE_TILE_SIZE, job->nr_probes);
+		gint g_end = MIN(g0 + SCORE_TILE_SIZE, job->gallery_len);
+		gint p, g;
+
+		struct xyt_struct gbuf[SCORE_TILE_SIZE];
+		struct xyt_struct *gstruct[SCORE_TILE_SIZE];
+
+		for (g = g0; g < g_end; g++)
+			gstruct[g - g0] = fpi_img_print_data_get_xyt(job->gallery[g],
+				&gbuf[g - g0]);
+
+		for (p = p0; p < p_end; p++) {
+			struct fp_print_data *probe = job->probes[p];
+			struct xyt_struct pbuf;
+			struct xyt_struct *pstruct = fpi_img_print_data_get_xyt(probe,
+				&pbuf);
+			int probe_len = bozorth_probe_web(ctx, probe->web);
+			int *row = job->scores + (size_t) p * job->gallery_len;
+
+			for (g = g0; g < g_end; g++)
+				row[g] = bozorth_to_gallery_web(ctx, probe_len, pstruct,
+					gstruct[g - g0], job->gallery[g]->web);
+		}
+	}
+}
+
+/** \ingroup print_data
+ * Compares every print in one set with every print in another, as an
+ * application looking for duplicate enrollments might. This is much faster
+ * than comparing the prints pair by pair: each print is prepared for matching
+ * only once, and the comparisons are spread over all available processors.
+ *
+ * The prints must all come from imaging devices. The scores are the same
+ * ones which fp_identify_finger_img_ranked() reports.
+ *
+ * \param probes NULL-terminated array of pointers to M prints
+ * \param gallery NULL-terminated array of pointers to N prints. It may be the
+ * same array as probes.
+ * \param scores array of M*N elements, which is filled so that element
+ * i*N+j holds the score of probes[i] against gallery[j]
+ * \returns 0 on success, -EINVAL if a print is not from an imaging device
+ * or is corrupt, -ENOMEM if memory ran out. A print without minutiae is no
+ * error, it simply scores 0 against every other.
+ */
+API_EXPORTED int fp_print_data_score_matrix(struct fp_print_data **probes,
+	struct fp_print_data **gallery, int *scores)
+{
+	struct score_matrix_job job;
+	struct bz_ctx *ctx;
+	GTimer *timer;
+	int nthreads;
+	gint i;
+
+	memset(&job, 0, sizeof(job));
+	job.probes = probes;
+	job.gallery = gallery;
+	job.scores = scores;
+	while (probes[job.nr_probes])
+		job.nr_probes++;
+	while (gallery[job.gallery_len])
+		job.gallery_len++;
+
+	/* rule out prints which can never be matched up front, so that a web
+	 * which cannot be built later on can only mean that memory ran out */
+	for (i = 0; i < job.nr_probes + job.gallery_len; i++) {
+		struct fp_print_data *print = score_matrix_print(&job, i);
+
+		if (!PRINT_DATA_IS_NBIS(print->type)) {
+			fp_err("print is not from an imaging device");
+			return -EINVAL;
+		}
+		if (!fpi_img_print_data_is_valid(print)) {
+			fp_err("print %d is corrupt", i);
+			return -EINVAL;
+		}
+	}
+
+	job.tiles_per_row = (job.gallery_len + SCORE_TILE_SIZE - 1)
+		/ SCORE_TILE_SIZE;
+	job.nr_tiles = job.tiles_per_row
+		* ((job.nr_probes + SCORE_TILE_SIZE - 1) / SCORE_TILE_SIZE);
+	if (job.nr_tiles == 0)
+		return 0;
+
+	ctx = bz_ctx_get();
+	if (!ctx)
+		return -ENOMEM;
+
+	timer = g_timer_new();
+	nthreads = fpi_work_pool_threads(&match_pool);
+
+	job.base.run = score_matrix_prepare;
+	match_job_run(&job.base, ctx,
+		MIN(nthreads, job.nr_probes + job.gallery_len - 1));
+
+	nthreads = MIN(nthreads, job.nr_tiles - 1);
+	if (!job.failed) {
+		job.next = 0;
+		job.base.run = score_matrix_run;
+		match_job_run(&job.base, ctx, nthreads);
+	}
+
+	g_timer_stop(timer);
+	fp_dbg("%dx%d score matrix with %d helper threads took %f seconds",
+		job.nr_probes, job.gallery_len, nthreads,
+		g_timer_elapsed(timer, NULL));
+	g_timer_destroy(timer);
+	bz_ctx_put(ctx);
+
+	return job.failed ? -ENOMEM : 0;
+}
+
 /** \ingroup img
  * Get a binarized form of a standardized scanned image. This is where the
  * fingerprint image has been "enhanced" and is a set of pure black ridges
@@ -26,6 +26,8 @@
 #define MIN_ACCEPTABLE_MINUTIAE 10
 #define BOZORTH3_DEFAULT_THRESHOLD 40
 
+static void process_cancel(struct fp_img_dev *imgdev);
+
 static int img_dev_open(struct fp_dev *dev, unsigned long driver_data)
 {
 	struct fp_img_dev *imgdev = g_malloc0(sizeof(*imgdev));
@@ -63,6 +65,9 @@ static void img_dev_close(struct fp_dev *dev)
 	struct fp_img_dev *imgdev = dev->priv;
 	struct fp_img_driver *imgdrv = fpi_driver_to_img_driver(dev->drv);
 
+	/* the device is freed once the driver is done closing it */
+	process_cancel(imgdev);
+
 	if (imgdrv->close)
 		imgdrv->close(imgdev);
 	else
@@ -125,6 +130,12 @@ void fpi_imgdev_report_finger_status(struct fp_img_dev *imgdev,
 
 	fp_dbg(present ? "finger on sensor" : "finger removed");
 
+	if (!present && imgdev->action_state == IMG_ACQUIRE_STATE_PROCESSING) {
+		/* results are reported once processing completes */
+		imgdev->finger_off_pending = TRUE;
+		return;
+	}
+
 	if (present && imgdev->action_state == IMG_ACQUIRE_STATE_AWAIT_FINGER_ON) {
 		dev_change_state(imgdev, IMGDEV_STATE_CAPTURE);
 		imgdev->action_state = IMG_ACQUIRE_STATE_AWAIT_IMAGE;
@@ -166,96 +177,376 @@ void fpi_imgdev_report_finger_status(struct fp_img_dev *imgdev,
 	}
 }
 
-static void verify_process_img(struct fp_img_dev *imgdev)
+/* Processing a captured image, from standardization to matching, takes long
+ * enough that doing it in a transfer callback would hold up every other
+ * device served by the same event loop. Images are processed on this pool
+ * instead, and the results are taken up again from within the event loop. */
+struct fpi_process_job {
+	struct fp_img_dev *imgdev;	/* NULL once the action was stopped */
+	struct fp_dev *dev;
+	enum fp_imgdev_action action;
+	struct fp_img *img;
+
+	/* results */
+	struct fp_print_data *print;
+	int result;
+	size_t match_offset;
+
+	GMutex lock;
+	GCond done;
+	/* set by whoever processes the job, the pool or the event loop */
+	gboolean claimed;
+	gboolean finished;
+	/* the event loop's, plus the pool's while the job is queued */
+	int refs;
+};
+
+G_LOCK_DEFINE_STATIC(process_pool);
+static GThreadPool *process_pool = NULL;
+static gboolean process_pool_failed = FALSE;
+/* jobs pushed to the pool which no thread has taken yet */
+static GSList *process_queued = NULL;
+
+static int verify_process_img(struct fp_dev *dev, struct fp_print_data *print)
 {
-	struct fp_img_driver *imgdrv = fpi_driver_to_img_driver(imgdev->dev->drv);
+	struct fp_img_driver *imgdrv = fpi_driver_to_img_driver(dev->drv);
 	int match_score = imgdrv->bz3_threshold;
 	int r;
 
 	if (match_score == 0)
 		match_score = BOZORTH3_DEFAULT_THRESHOLD;
 
-	r = fpi_img_compare_print_data(imgdev->dev->verify_data,
-		imgdev->acquire_data);
+	r = fpi_img_compare_print_data(dev->verify_data, print, match_score);
 
 	if (r >= match_score)
 		r = FP_VERIFY_MATCH;
 	else if (r >= 0)
 		r = FP_VERIFY_NO_MATCH;
 
-	imgdev->action_result = r;
+	return r;
 }
 
-static void identify_process_img(struct fp_img_dev *imgdev)
+static int identify_process_img(struct fp_dev *dev,
+	struct fp_print_data *print, size_t *match_offset)
 {
-	struct fp_img_driver *imgdrv = fpi_driver_to_img_driver(imgdev->dev->drv);
+	struct fp_img_driver *imgdrv = fpi_driver_to_img_driver(dev->drv);
 	int match_score = imgdrv->bz3_threshold;
-	size_t match_offset;
 	int r;
 
 	if (match_score == 0)
 		match_score = BOZORTH3_DEFAULT_THRESHOLD;
 
-	r = fpi_img_compare_print_data_to_gallery(imgdev->acquire_data,
-		imgdev->dev->identify_gallery, match_score, &match_offset);
+	if (dev->identify_matches) {
+		r = fpi_img_rank_print_data_in_gallery(print,
+			dev->identify_gallery, match_score, dev->identify_matches,
+			dev->identify_max_matches, &dev->identify_nr_matches);
+		*match_offset = dev->identify_nr_matches
+			? dev->identify_matches[0].offset : 0;
+	} else if (dev->identify_index) {
+		r = fpi_print_index_identify(dev->identify_index, print,
+			match_score, match_offset);
+	} else {
+		r = fpi_img_compare_print_data_to_gallery(print,
+			dev->identify_gallery, match_score, match_offset);
+	}
 
-	imgdev->action_result = r;
-	imgdev->identify_match_offset = match_offset;
+	return r;
 }
 
-void fpi_imgdev_image_captured(struct fp_img_dev *imgdev, struct fp_img *img)
+/* Does the actual processing, usually on a worker thread. It must not change
+ * the imgdev or the device, which only the event loop may do, and only reads
+ * what stays put until process_cancel() has waited for the job: the driver
+ * and device type the print is tagged with, and the print data the action
+ * was started with. */
+static void process_img(struct fpi_process_job *job)
 {
+	struct fp_img *img = job->img;
 	struct fp_print_data *print;
 	int r;
-	fp_dbg("");
-
-	if (imgdev->action_state != IMG_ACQUIRE_STATE_AWAIT_IMAGE) {
-		fp_dbg("ignoring due to current state %d", imgdev->action_state);
-		return;
-	}
-
-	if (imgdev->action_result) {
-		fp_dbg("not overwriting existing action result");
-		return;
-	}
 
-	r = sanitize_image(imgdev, &img);
+	fp_img_standardize(img);
+	r = fpi_img_to_print_data(job->dev->priv, img, &print);
 	if (r < 0) {
-		imgdev->action_result = r;
-		fp_img_free(img);
-		goto next_state;
+		job->result = r;
+		return;
 	}
 
-	fp_img_standardize(img);
-	imgdev->acquire_img = img;
-	fpi_img_to_print_data(imgdev, img, &print);
 	if (img->minutiae->num < MIN_ACCEPTABLE_MINUTIAE) {
 		fp_dbg("not enough minutiae, %d/%d", img->minutiae->num,
 			MIN_ACCEPTABLE_MINUTIAE);
 		fp_print_data_free(print);
 		/* depends on FP_ENROLL_RETRY == FP_VERIFY_RETRY */
-		imgdev->action_result = FP_ENROLL_RETRY;
-		goto next_state;
+		job->result = FP_ENROLL_RETRY;
+		return;
 	}
 
-	imgdev->acquire_data = print;
-	switch (imgdev->action) {
+	job->print = print;
+	switch (job->action) {
 	case IMG_ACTION_ENROLL:
-		imgdev->action_result = FP_ENROLL_COMPLETE;
+		job->result = FP_ENROLL_COMPLETE;
 		break;
 	case IMG_ACTION_VERIFY:
-		verify_process_img(imgdev);
+		job->result = verify_process_img(job->dev, print);
 		break;
 	case IMG_ACTION_IDENTIFY:
-		identify_process_img(imgdev);
+		job->result = identify_process_img(job->dev, print,
+			&job->match_offset);
 		break;
 	default:
 		BUG();
 		break;
 	}
+}
+
+static void process_job_unref(struct fpi_process_job *job)
+{
+	gboolean last;
+
+	g_mutex_lock(&job->lock);
+	last = --job->refs == 0;
+	g_mutex_unlock(&job->lock);
+
+	if (last) {
+		g_cond_clear(&job->done);
+		g_mutex_clear(&job->lock);
+		g_free(job);
+	}
+}
+
+/* Takes up the results of a job from within the event loop */
+static void process_complete(void *data)
+{
+	struct fpi_process_job *job = data;
+	struct fp_img_dev *imgdev;
+
+	/* the worker defers this just before it lets go of the job */
+	g_mutex_lock(&job->lock);
+	while (!job->finished)
+		g_cond_wait(&job->done, &job->lock);
+	g_mutex_unlock(&job->lock);
+
+	imgdev = job->imgdev;
+	if (!imgdev) {
+		fp_dbg("action stopped while processing, dropping results");
+		fp_print_data_free(job->print);
+		fp_img_free(job->img);
+	} else {
+		imgdev->process_job = NULL;
+		imgdev->acquire_img = job->img;
+		imgdev->acquire_data = job->print;
+		imgdev->action_result = job->result;
+		imgdev->identify_match_offset = job->match_offset;
+		imgdev->action_state = IMG_ACQUIRE_STATE_AWAIT_FINGER_OFF;
+	}
+
+	process_job_unref(job);
+
+	if (imgdev && imgdev->finger_off_pending) {
+		imgdev->finger_off_pending = FALSE;
+		fpi_imgdev_report_finger_status(imgdev, FALSE);
+	}
+}
+
+/* Returns TRUE if the caller is the one to process the job */
+static gboolean process_claim(struct fpi_process_job *job)
+{
+	gboolean claimed;
+
+	g_mutex_lock(&job->lock);
+	claimed = job->claimed;
+	job->claimed = TRUE;
+	g_mutex_unlock(&job->lock);
+	return !claimed;
+}
+
+static void process_run(struct fpi_process_job *job)
+{
+	process_img(job);
+
+	fpi_poll_defer(process_complete, job);
+	g_mutex_lock(&job->lock);
+	job->finished = TRUE;
+	g_cond_broadcast(&job->done);
+	g_mutex_unlock(&job->lock);
+}
+
+static void process_worker(gpointer data, gpointer user_data)
+{
+	struct fpi_process_job *job = data;
+
+	G_LOCK(process_pool);
+	process_queued = g_slist_remove(process_queued, job);
+	G_UNLOCK(process_pool);
+
+	if (process_claim(job))
+		process_run(job);
+	process_job_unref(job);
+}
+
+static GThreadPool *process_pool_get(void)
+{
+	GThreadPool *pool;
+
+	G_LOCK(process_pool);
+	if (!process_pool && !process_pool_failed) {
+		GError *err = NULL;
+
+		/* each device has at most one image in flight, and jobs are
+		 * taken in the order they come, so with many devices busy
+		 * they are served in turn. detection and matching spread
+		 * themselves over the processors as well, but with a job
+		 * per processor, none wait for the others' stragglers. */
+		process_pool = g_thread_pool_new(process_worker, NULL,
+			g_get_num_processors(), FALSE, &err);
+		if (!process_pool) {
+			fp_err("could not create processing pool, processing "
+				"images in the event loop: %s", err->message);
+			g_error_free(err);
+			process_pool_failed = TRUE;
+		}
+	}
+	pool = process_pool;
+	G_UNLOCK(process_pool);
+	return pool;
+}
+
+void fpi_imgdev_exit(void)
+{
+	GThreadPool *pool;
+	GSList *queued;
+	GSList *elem;
+
+	G_LOCK(process_pool);
+	pool = process_pool;
+	process_pool = NULL;
+	process_pool_failed = FALSE;
+	G_UNLOCK(process_pool);
+
+	/* a pool which could not start a thread may never get to the jobs
+	 * still queued, so rather than waiting for it they are dropped from
+	 * it and taken care of here */
+	if (pool)
+		g_thread_pool_free(pool, TRUE, TRUE);
+
+	G_LOCK(process_pool);
+	queued = process_queued;
+	process_queued = NULL;
+	G_UNLOCK(process_pool);
+
+	/* closing a device cancels its job, so all that should be left is the
+	 * pool's reference to jobs which were cancelled or processed in the
+	 * event loop. a job nobody has claimed yet is processed here, its
+	 * results being taken up when the deferred calls are flushed. */
+	for (elem = queued; elem; elem = g_slist_next(elem)) {
+		struct fpi_process_job *job = elem->data;
+
+		if (process_claim(job))
+			process_run(job);
+		process_job_unref(job);
+	}
+	g_slist_free(queued);
+}
+
+/* Drops the job in progress, if any. A job no thread has taken yet is never
+ * processed, otherwise this waits for the worker, which may be reading the
+ * print data the action was started with, which the application is free to
+ * release once the action stops, and makes sure its results are dropped. */
+static void process_cancel(struct fp_img_dev *imgdev)
+{
+	struct fpi_process_job *job = imgdev->process_job;
+
+	if (!job)
+		return;
+
+	g_mutex_lock(&job->lock);
+	job->imgdev = NULL;
+	g_mutex_unlock(&job->lock);
+
+	if (process_claim(job)) {
+		fp_dbg("dropping image before processing");
+		g_mutex_lock(&job->lock);
+		job->finished = TRUE;
+		g_mutex_unlock(&job->lock);
+		fp_img_free(job->img);
+		/* the pool's reference goes once a thread gets to the job */
+		process_job_unref(job);
+	} else {
+		fp_dbg("waiting for image processing to finish");
+		g_mutex_lock(&job->lock);
+		while (!job->finished)
+			g_cond_wait(&job->done, &job->lock);
+		g_mutex_unlock(&job->lock);
+	}
+
+	imgdev->process_job = NULL;
+	imgdev->finger_off_pending = FALSE;
+}
+
+void fpi_imgdev_image_captured(struct fp_img_dev *imgdev, struct fp_img *img)
+{
+	struct fpi_process_job *job;
+	GThreadPool *pool;
+	int r;
+	fp_dbg("");
+
+	if (imgdev->action_state != IMG_ACQUIRE_STATE_AWAIT_IMAGE) {
+		fp_dbg("ignoring due to current state %d", imgdev->action_state);
+		return;
+	}
+
+	if (imgdev->action_result) {
+		fp_dbg("not overwriting existing action result");
+		return;
+	}
+
+	r = sanitize_image(imgdev, &img);
+	if (r < 0) {
+		imgdev->action_result = r;
+		fp_img_free(img);
+		imgdev->action_state = IMG_ACQUIRE_STATE_AWAIT_FINGER_OFF;
+		dev_change_state(imgdev, IMGDEV_STATE_AWAIT_FINGER_OFF);
+		return;
+	}
+
+	job = g_malloc0(sizeof(*job));
+	job->imgdev = imgdev;
+	job->dev = imgdev->dev;
+	job->action = imgdev->action;
+	job->img = img;
+	g_mutex_init(&job->lock);
+	g_cond_init(&job->done);
+	job->refs = 1;
+
+	imgdev->process_job = job;
+	imgdev->finger_off_pending = FALSE;
+	imgdev->action_state = IMG_ACQUIRE_STATE_PROCESSING;
+
+	/* without a pool, results are still taken up from the event loop, so
+	 * that drivers see the same sequence of calls either way */
+	pool = process_pool_get();
+	if (pool) {
+		GError *err = NULL;
+
+		job->refs++;
+		G_LOCK(process_pool);
+		process_queued = g_slist_prepend(process_queued, job);
+		G_UNLOCK(process_pool);
+		/* the job is queued even if no thread could be started for
+		 * it, and may yet be picked up by a thread which is already
+		 * running, so the pool and the event loop race for it */
+		if (!g_thread_pool_push(pool, job, &err)) {
+			fp_err("could not start processing thread, processing "
+				"image in the event loop: %s", err->message);
+			g_error_free(err);
+			if (process_claim(job))
+				process_run(job);
+		}
+	} else {
+		job->claimed = TRUE;
+		process_run(job);
+	}
 
-next_state:
-	imgdev->action_state = IMG_ACQUIRE_STATE_AWAIT_FINGER_OFF;
+	/* the device can watch for the finger going away meanwhile */
 	dev_change_state(imgdev, IMGDEV_STATE_AWAIT_FINGER_OFF);
 }
 
@@ -389,6 +680,7 @@ static int generic_acquire_start(struct fp_dev *dev, int action)
 
 static void generic_acquire_stop(struct fp_img_dev *imgdev)
 {
+	process_cancel(imgdev);
 	imgdev->action_state = IMG_ACQUIRE_STATE_DEACTIVATING;
 	dev_deactivate(imgdev);
 
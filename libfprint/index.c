@@ -0,0 +1,366 @@
+/*
+ * Gallery pre-filtering for identification
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "index"
+
+#include <config.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "fp_internal.h"
+#include "nbis/include/bozorth.h"
+
+/** @defgroup print_index Print indexes
+ * Identifying a finger against a large gallery compares the scan with every
+ * print in it, which gets slow as the gallery grows. A print index holds a
+ * compact summary of each gallery print, cheap enough to compare with all of
+ * them, which is used to pick out the small share of the gallery most likely
+ * to match. Only those candidates then go through full matching.
+ *
+ * The share of the gallery which is examined is called the penetration rate.
+ * Lower rates make identification faster, but make it more likely that the
+ * right print is missed. See fp_print_index_set_penetration().
+ *
+ * Print indexes only work with prints enrolled on imaging devices.
+ */
+
+/* Each print is summarised by a histogram over the pairs of its minutiae
+ * which are close enough for bozorth3 to relate them. A pair is binned by its
+ * length, by the angle between the two minutiae, and by the smaller of the
+ * angles each minutia makes with the line joining them. None of these depend
+ * on where the finger was placed, or at what angle. */
+#define INDEX_DIST_BINS		8
+#define INDEX_DTHETA_BINS	6
+#define INDEX_BETA_BINS		4
+#define INDEX_BINS \
+	(INDEX_DIST_BINS * INDEX_DTHETA_BINS * INDEX_BETA_BINS)
+
+/* Pairs further apart than this are left out, as bozorth3 does */
+#define INDEX_MIN_DIST		10
+#define INDEX_MAX_DIST		DM
+
+/* Histograms are scaled to this total, so that prints with different numbers
+ * of minutiae compare on an equal footing. It is small enough that no bin
+ * comes close to overflowing a byte in practice. */
+#define INDEX_HIST_TOTAL	4096
+
+#define INDEX_DEFAULT_PENETRATION	100
+/* Small galleries are cheap to search, so do not bother narrowing them down
+ * below this many candidates */
+#define INDEX_MIN_CANDIDATES		32
+
+struct fp_print_index {
+	struct fp_print_data **gallery;
+	size_t len;
+	unsigned int permille;
+	guint8 (*hists)[INDEX_BINS];
+};
+
+/* Folds an angle in degrees into [0, 180] */
+static int fold_angle(int a)
+{
+	a %= 360;
+	if (a < 0)
+		a += 360;
+	return a > 180 ? 360 - a : a;
+}
+
+/* Adds weight to the bins either side of a fractional bin position, so that
+ * a pair near a bin boundary is not lost to noise moving it across. */
+static void soft_bin(float pos, int nbins, int *lo, int *hi, float *w)
+{
+	int b = (int) floorf(pos - 0.5f);
+
+	*w = pos - 0.5f - b;
+	*lo = CLAMP(b, 0, nbins - 1);
+	*hi = CLAMP(b + 1, 0, nbins - 1);
+}
+
+static void build_histogram(struct xyt_struct *xyt, guint8 *out)
+{
+	float hist[INDEX_BINS];
+	float total = 0;
+	int i, j;
+
+	memset(hist, 0, sizeof(hist));
+
+	for (i = 0; i < xyt->nrows; i++) {
+		for (j = i + 1; j < xyt->nrows; j++) {
+			int dx = xyt->xcol[j] - xyt->xcol[i];
+			int dy = xyt->ycol[j] - xyt->ycol[i];
+			int dist2 = dx * dx + dy * dy;
+			int dtheta, beta, angle;
+			int d[2], t[2], b[2];
+			float wd, wt, wb;
+			int x, y, z;
+
+			if (dist2 < INDEX_MIN_DIST * INDEX_MIN_DIST
+					|| dist2 > INDEX_MAX_DIST * INDEX_MAX_DIST)
+				continue;
+
+			dtheta = fold_angle(xyt->thetacol[j] - xyt->thetacol[i]);
+			angle = (int) lrintf(atan2f(dy, dx) * 180.0f / PI_SINGLE);
+			beta = MIN(fold_angle(angle - xyt->thetacol[i]),
+				fold_angle(angle + 180 - xyt->thetacol[j]));
+
+			soft_bin((sqrtf(dist2) - INDEX_MIN_DIST) * INDEX_DIST_BINS
+				/ (INDEX_MAX_DIST - INDEX_MIN_DIST), INDEX_DIST_BINS,
+				&d[0], &d[1], &wd);
+			soft_bin(dtheta * INDEX_DTHETA_BINS / 180.0f, INDEX_DTHETA_BINS,
+				&t[0], &t[1], &wt);
+			soft_bin(beta * INDEX_BETA_BINS / 180.0f, INDEX_BETA_BINS,
+				&b[0], &b[1], &wb);
+
+			for (x = 0; x < 2; x++)
+				for (y = 0; y < 2; y++)
+					for (z = 0; z < 2; z++)
+						hist[(d[x] * INDEX_DTHETA_BINS + t[y])
+							* INDEX_BETA_BINS + b[z]] +=
+							(x ? wd : 1 - wd) * (y ? wt : 1 - wt)
+							* (z ? wb : 1 - wb);
+			total += 1;
+		}
+	}
+
+	for (i = 0; i < INDEX_BINS; i++) {
+		int v = total ? (int) lrintf(hist[i] * INDEX_HIST_TOTAL / total) : 0;
+		out[i] = MIN(v, 255);
+	}
+}
+
+/* Histogram intersection: the weight the two histograms have in common */
+static int histogram_similarity(const guint8 *a, const guint8 *b)
+{
+	int s = 0;
+	int i;
+
+	for (i = 0; i < INDEX_BINS; i++)
+		s += MIN(a[i], b[i]);
+	return s;
+}
+
+/** \ingroup print_index
+ * Builds an index over a gallery of prints, for use with
+ * fp_identify_finger_img_indexed().
+ *
+ * The index refers to the gallery rather than copying it, so the gallery
+ * array and the prints in it must not be changed or freed until the index
+ * has been freed. If the gallery changes, build a new index.
+ *
+ * \param gallery NULL-terminated array of pointers to the prints to index.
+ * Each one must have been enrolled with an imaging device.
+ * \returns the new index, or NULL on error, such as a print in the gallery
+ * not coming from an imaging device. Must be freed with fp_print_index_free()
+ * after use.
+ */
+API_EXPORTED struct fp_print_index *fp_print_index_new(
+	struct fp_print_data **gallery)
+{
+	struct fp_print_index *idx;
+	size_t i;
+
+	idx = g_malloc0(sizeof(*idx));
+	idx->gallery = gallery;
+	idx->permille = INDEX_DEFAULT_PENETRATION;
+	while (gallery[idx->len])
+		idx->len++;
+	idx->hists = g_malloc(idx->len * sizeof(*idx->hists));
+
+	for (i = 0; i < idx->len; i++) {
+		struct xyt_struct buf, *xyt;
+
+		xyt = fpi_img_print_data_get_xyt(gallery[i], &buf);
+		if (!xyt) {
+			fp_err("print %zd is not from an imaging device", i);
+			fp_print_index_free(idx);
+			return NULL;
+		}
+		build_histogram(xyt, idx->hists[i]);
+	}
+
+	fp_dbg("indexed %zd prints", idx->len);
+	return idx;
+}
+
+/** \ingroup print_index
+ * Frees an index. The gallery it was built over is left alone.
+ * \param idx the index to free. If NULL, function simply returns.
+ */
+API_EXPORTED void fp_print_index_free(struct fp_print_index *idx)
+{
+	if (!idx)
+		return;
+	g_free(idx->hists);
+	g_free(idx);
+}
+
+/** \ingroup print_index
+ * Sets the share of the gallery which searches through this index pass on
+ * to full matching. The default is 100 per thousand, i.e. a tenth of the
+ * gallery. However low it is set, galleries of a few dozen prints are always
+ * searched in full.
+ *
+ * \param idx the index
+ * \param permille how many prints to pass on per thousand in the gallery,
+ * from 1 to 1000. 1000 disables pre-filtering altogether.
+ */
+API_EXPORTED void fp_print_index_set_penetration(struct fp_print_index *idx,
+	unsigned int permille)
+{
+	idx->permille = CLAMP(permille, 1, 1000);
+}
+
+struct index_candidate {
+	size_t offset;
+	int score;
+};
+
+/* Best first; equal scores in gallery order */
+static int candidate_cmp(const void *a, const void *b)
+{
+	const struct index_candidate *ca = a;
+	const struct index_candidate *cb = b;
+
+	if (ca->score != cb->score)
+		return cb->score - ca->score;
+	return ca->offset < cb->offset ? -1 : ca->offset > cb->offset;
+}
+
+/** \ingroup print_index
+ * Picks out the gallery prints most likely to match a print, as many as the
+ * index's penetration rate allows. This is the search that
+ * fp_identify_finger_img_indexed() does before matching; it is exposed so
+ * that applications can measure how well the index works with their data.
+ *
+ * \param idx the index to search
+ * \param print the print to look for
+ * \param nr_candidates output location for the number of candidates found
+ * \returns array of nr_candidates gallery offsets, most likely match first, or
+ * NULL on error. Must be freed with free() after use.
+ */
+API_EXPORTED size_t *fp_print_index_search(struct fp_print_index *idx,
+	struct fp_print_data *print, size_t *nr_candidates)
+{
+	guint8 probe[INDEX_BINS];
+	struct xyt_struct buf, *xyt;
+	int *scores;
+	size_t *counts;
+	struct index_candidate *cands;
+	size_t *offsets;
+	size_t want, have, nr, i;
+	int cutoff;
+
+	xyt = fpi_img_print_data_get_xyt(print, &buf);
+	if (!xyt) {
+		fp_err("print is not from an imaging device");
+		return NULL;
+	}
+
+	want = (idx->len * idx->permille + 999) / 1000;
+	want = MIN(MAX(want, INDEX_MIN_CANDIDATES), idx->len);
+
+	build_histogram(xyt, probe);
+
+	/* Similarities are small integers, so the cut-off score for the best
+	 * want candidates is found by counting, without sorting the gallery. */
+	scores = g_malloc(idx->len * sizeof(*scores));
+	counts = g_malloc0((INDEX_HIST_TOTAL + 1) * sizeof(*counts));
+	for (i = 0; i < idx->len; i++) {
+		scores[i] = MIN(histogram_similarity(probe, idx->hists[i]),
+			INDEX_HIST_TOTAL);
+		counts[scores[i]]++;
+	}
+
+	have = 0;
+	for (cutoff = INDEX_HIST_TOTAL; cutoff > 0; cutoff--) {
+		if (have + counts[cutoff] >= want)
+			break;
+		have += counts[cutoff];
+	}
+
+	/* Everything above the cut-off goes in, and ties at it are taken in
+	 * gallery order until there are enough. */
+	cands = g_malloc(MAX(want, 1) * sizeof(*cands));
+	nr = 0;
+	for (i = 0; i < idx->len && nr < want; i++) {
+		if (scores[i] > cutoff
+				|| (scores[i] == cutoff && have < want)) {
+			if (scores[i] == cutoff)
+				have++;
+			cands[nr].offset = i;
+			cands[nr].score = scores[i];
+			nr++;
+		}
+	}
+	qsort(cands, nr, sizeof(*cands), candidate_cmp);
+
+	offsets = malloc(MAX(nr, 1) * sizeof(*offsets));
+	if (offsets)
+		for (i = 0; i < nr; i++)
+			offsets[i] = cands[i].offset;
+
+	g_free(cands);
+	g_free(counts);
+	g_free(scores);
+
+	if (!offsets)
+		return NULL;
+	fp_dbg("%zd of %zd prints are candidates", nr, idx->len);
+	*nr_candidates = nr;
+	return offsets;
+}
+
+/* Identifies a print against the candidates the index picks out of its
+ * gallery, most likely first, reporting the gallery offset of the first one
+ * to score at least match_threshold. */
+int fpi_print_index_identify(struct fp_print_index *idx,
+	struct fp_print_data *print, int match_threshold, size_t *match_offset)
+{
+	struct fp_print_data **candidates;
+	size_t *offsets;
+	size_t nr, i;
+	size_t offset;
+	int r;
+
+	offsets = fp_print_index_search(idx, print, &nr);
+	if (!offsets)
+		return -EINVAL;
+
+	candidates = g_new(struct fp_print_data *, nr + 1);
+	for (i = 0; i < nr; i++)
+		candidates[i] = idx->gallery[offsets[i]];
+	candidates[nr] = NULL;
+
+	r = fpi_img_compare_print_data_to_gallery(print, candidates,
+		match_threshold, &offset);
+	if (r == FP_VERIFY_MATCH)
+		*match_offset = offsets[offset];
+
+	g_free(candidates);
+	free(offsets);
+	return r;
+}
+
+struct fp_print_data **fpi_print_index_get_gallery(struct fp_print_index *idx)
+{
+	return idx->gallery;
+}
@@ -0,0 +1,257 @@
+/*
+ * Score matrix checker
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Usage: matrix-check [-n PRINTS]
+ *
+ * Scores PRINTS (default 40) synthetic probes against as many synthetic
+ * gallery prints, half of them mated, with fp_print_data_score_matrix() and
+ * checks every score against a plain bozorth_main() comparison. Then puts
+ * prints which cannot be matched (from another kind of device, or corrupt)
+ * into the gallery in turn and checks that the matrix is refused with
+ * -EINVAL, and checks that a print without minutiae merely scores 0. Not
+ * built by default, use "make matrix-check".
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fp_internal.h"
+#include "nbis/include/bozorth.h"
+
+#define CHECK_AREA_X	320
+#define CHECK_AREA_Y	400
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned int rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state >> 11;
+}
+
+static int cmp_minutia(const void *a, const void *b)
+{
+	const int *p = a, *q = b;
+	if (p[0] != q[0])
+		return p[0] - q[0];
+	return p[1] - q[1];
+}
+
+/* bozorth3 wants its minutiae in x, then y order */
+static void set_xyt(struct xyt_struct *xyt, int pts[][3], int n)
+{
+	int i;
+
+	qsort(pts, n, sizeof(pts[0]), cmp_minutia);
+	memset(xyt, 0, sizeof(*xyt));
+	xyt->nrows = n;
+	for (i = 0; i < n; i++) {
+		xyt->xcol[i] = pts[i][0];
+		xyt->ycol[i] = pts[i][1];
+		xyt->thetacol[i] = pts[i][2];
+	}
+}
+
+static void random_minutia(int *pt)
+{
+	pt[0] = rng() % CHECK_AREA_X + 20;
+	pt[1] = rng() % CHECK_AREA_Y + 20;
+	pt[2] = (int) (rng() % 360) - 179;
+}
+
+/* Fills in a probe and a gallery print, the latter being the probe shifted
+ * a little with jittered and dropped minutiae if mated. */
+static void make_pair(struct xyt_struct *probe, struct xyt_struct *gallery,
+	int mated)
+{
+	static int p[MAX_BOZORTH_MINUTIAE][3], g[MAX_BOZORTH_MINUTIAE][3];
+	int n = 30 + rng() % 40;
+	int dx = (int) (rng() % 30) - 15;
+	int dy = (int) (rng() % 30) - 15;
+	int i, m = 0;
+
+	for (i = 0; i < n; i++)
+		random_minutia(p[i]);
+
+	if (!mated) {
+		m = n - 10 + rng() % 20;
+		for (i = 0; i < m; i++)
+			random_minutia(g[i]);
+	} else {
+		for (i = 0; i < n; i++) {
+			int t;
+
+			if (rng() % 6 == 0)
+				continue;
+			g[m][0] = p[i][0] + dx + (int) (rng() % 5) - 2;
+			g[m][1] = p[i][1] + dy + (int) (rng() % 5) - 2;
+			t = p[i][2] + (int) (rng() % 9) - 4;
+			g[m][2] = IANGLE180(t);
+			m++;
+		}
+	}
+
+	set_xyt(probe, p, n);
+	set_xyt(gallery, g, m);
+}
+
+static struct fp_print_data *make_print(struct fp_dev *dev,
+	struct xyt_struct *xyt)
+{
+	struct fp_print_data *print = fpi_print_data_new(dev, sizeof(*xyt));
+
+	print->type = PRINT_DATA_NBIS_MINUTIAE;
+	memcpy(print->data, xyt, sizeof(*xyt));
+	return print;
+}
+
+/* Scores the probes against the gallery with gallery[slot] replaced by bad,
+ * which must be refused. */
+static int check_invalid(const char *what, struct fp_print_data **probes,
+	struct fp_print_data **gallery, int slot, struct fp_print_data *bad,
+	int *scores)
+{
+	struct fp_print_data *saved = gallery[slot];
+	int r;
+
+	gallery[slot] = bad;
+	r = fp_print_data_score_matrix(probes, gallery, scores);
+	gallery[slot] = saved;
+	fp_print_data_free(bad);
+
+	printf("%-32s %s (%d)\n", what, r == -EINVAL ? "refused" : "WRONG", r);
+	return r != -EINVAL;
+}
+
+int main(int argc, char **argv)
+{
+	static struct fp_driver drv = {
+		.id = 0xffff,
+		.name = "matrix-check",
+		.full_name = "Score matrix checker",
+		.type = DRIVER_IMAGING,
+	};
+	struct fp_dev dev;
+	struct fp_print_data **probes, **gallery, *bad;
+	struct xyt_struct *pxyt, *gxyt, empty;
+	struct bz_ctx *ctx;
+	int *scores;
+	int nprints = 40;
+	int failed = 0, diffs = 0;
+	int i, j, opt, r;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nprints = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n PRINTS]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (nprints < 1) {
+		fprintf(stderr, "need at least one print\n");
+		return 2;
+	}
+
+	r = fp_init();
+	if (r) {
+		fprintf(stderr, "could not initialise libfprint: %d\n", r);
+		return 1;
+	}
+	memset(&dev, 0, sizeof(dev));
+	dev.drv = &drv;
+
+	pxyt = calloc(nprints, sizeof(*pxyt));
+	gxyt = calloc(nprints, sizeof(*gxyt));
+	probes = calloc(nprints + 1, sizeof(*probes));
+	gallery = calloc(nprints + 1, sizeof(*gallery));
+	scores = calloc((size_t) nprints * nprints, sizeof(*scores));
+	ctx = bz_ctx_new();
+	for (i = 0; i < nprints; i++) {
+		make_pair(&pxyt[i], &gxyt[i], i % 2 == 0);
+		probes[i] = make_print(&dev, &pxyt[i]);
+		gallery[i] = make_print(&dev, &gxyt[i]);
+	}
+
+	r = fp_print_data_score_matrix(probes, gallery, scores);
+	if (r) {
+		printf("%dx%d score matrix failed: %d\n", nprints, nprints, r);
+		return 1;
+	}
+	for (i = 0; i < nprints; i++)
+		for (j = 0; j < nprints; j++)
+			diffs += scores[i * nprints + j]
+				!= bozorth_main(ctx, &pxyt[i], &gxyt[j]);
+	printf("%-32s %s (%d differences)\n", "valid prints",
+		diffs ? "MISMATCH" : "identical", diffs);
+	failed |= diffs != 0;
+
+	bad = fpi_print_data_new(&dev, 16);
+	bad->type = PRINT_DATA_RAW;
+	failed |= check_invalid("print from another device", probes, gallery,
+		0, bad, scores);
+
+	bad = fpi_print_data_new(&dev, 16);
+	bad->type = PRINT_DATA_NBIS_COMPACT;
+	memset(bad->data, 0xff, 16);
+	failed |= check_invalid("corrupt compact print", probes, gallery,
+		nprints / 2, bad, scores);
+
+	bad = make_print(&dev, &gxyt[0]);
+	((struct xyt_struct *) bad->data)->nrows = MAX_BOZORTH_MINUTIAE + 1;
+	failed |= check_invalid("corrupt minutiae", probes, gallery,
+		nprints - 1, bad, scores);
+
+	/* an empty print is scored like any other, as 0 */
+	memset(&empty, 0, sizeof(empty));
+	bad = gallery[nprints - 1];
+	gallery[nprints - 1] = make_print(&dev, &empty);
+	r = fp_print_data_score_matrix(probes, gallery, scores);
+	fp_print_data_free(gallery[nprints - 1]);
+	gallery[nprints - 1] = bad;
+	diffs = 0;
+	for (i = 0; r == 0 && i < nprints; i++)
+		diffs += scores[i * nprints + nprints - 1] != 0;
+	printf("%-32s %s (%d)\n", "print without minutiae",
+		r == 0 && diffs == 0 ? "scored 0" : "WRONG", r);
+	failed |= r != 0 || diffs != 0;
+
+	printf("%s\n", failed ? "FAILED" : "ok");
+
+	for (i = 0; i < nprints; i++) {
+		fp_print_data_free(probes[i]);
+		fp_print_data_free(gallery[i]);
+	}
+	bz_ctx_free(ctx);
+	free(scores);
+	free(gallery);
+	free(probes);
+	free(gxyt);
+	free(pxyt);
+	fp_exit();
+	return failed;
+}
@@ -0,0 +1,440 @@
+/*
+ * Multi-device latency benchmark
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Usage: mdev-bench [-e] [-n RESULTS] [-m DEVICES]
+ *
+ * Serves 1, 2, 4 and so on up to DEVICES (default 64) virtual imaging
+ * devices from a single event loop. Each device keeps verifying synthetic
+ * finger images against an enrolled print, a finger being placed a few tens
+ * of milliseconds after the previous result. For each number of devices,
+ * prints percentiles of the time from an image being captured to its result
+ * reaching the application, over RESULTS (default 20) results per device.
+ * With -e, the loop waits on fp_get_event_fd() and calls fp_dispatch_events()
+ * rather than calling fp_handle_events_timeout().
+ * Not built by default, use "make mdev-bench".
+ */
+
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fp_internal.h"
+
+#define IMG_WIDTH 256
+#define IMG_HEIGHT 360
+#define NR_IMAGES 8
+
+/* simulated delays, in milliseconds */
+#define ACTIVATE_DELAY 5
+#define FINGER_ON_DELAY_MIN 20
+#define FINGER_ON_DELAY_MAX 80
+#define CAPTURE_DELAY 30
+
+struct vdev {
+	struct fp_dev *dev;
+	struct fp_img_dev *imgdev;
+	struct fpi_timeout *timeout;
+	double captured_at;
+	int next_image;
+	int running;
+	int verifying;
+};
+
+static struct vdev *vdevs;
+static int nr_vdevs;
+static unsigned char *images[NR_IMAGES];
+static struct fp_print_data *enrolled;
+
+static int event_fd = -1;
+static int measuring;
+static double *latencies;
+static int nr_latencies;
+static int max_latencies;
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+static unsigned int rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state >> 11;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* Ridges curving around a core point, as in dft-check */
+static void make_image(unsigned char *img, int width, int height)
+{
+	double cx = width * (0.3 + 0.4 * (rng() % 1000) / 1000.0);
+	double cy = height * (0.3 + 0.4 * (rng() % 1000) / 1000.0);
+	double period = 7.0 + (rng() % 400) / 100.0;
+	double twist = (rng() % 1000) / 1000.0;
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			double dx = x - cx, dy = y - cy;
+			double r = sqrt(dx * dx + dy * dy);
+			double a = atan2(dy, dx);
+			double v = sin(2 * M_PI * (r + twist * 8 * a) / period);
+			int p = 128 + (int) (90 * v) + (int) (rng() % 41) - 20;
+			img[y * width + x] = p < 0 ? 0 : p > 255 ? 255 : p;
+		}
+	}
+}
+
+static struct fp_img *capture_image(struct vdev *v)
+{
+	struct fp_img *img = fpi_img_new(IMG_WIDTH * IMG_HEIGHT);
+
+	img->width = IMG_WIDTH;
+	img->height = IMG_HEIGHT;
+	memcpy(img->data, images[v->next_image], IMG_WIDTH * IMG_HEIGHT);
+	v->next_image = (v->next_image + 1) % NR_IMAGES;
+	return img;
+}
+
+/* The virtual driver. Every step the hardware would take is a timeout. */
+
+static void vdev_schedule(struct vdev *v, unsigned int msec,
+	fpi_timeout_fn callback)
+{
+	if (v->timeout)
+		fpi_timeout_cancel(v->timeout);
+	v->timeout = fpi_timeout_add(msec, callback, v);
+}
+
+static void activate_done(void *data)
+{
+	struct vdev *v = data;
+	v->timeout = NULL;
+	fpi_imgdev_activate_complete(v->imgdev, 0);
+}
+
+static void finger_on(void *data)
+{
+	struct vdev *v = data;
+	v->timeout = NULL;
+	fpi_imgdev_report_finger_status(v->imgdev, TRUE);
+}
+
+static void image_ready(void *data)
+{
+	struct vdev *v = data;
+	v->timeout = NULL;
+	v->captured_at = now();
+	fpi_imgdev_image_captured(v->imgdev, capture_image(v));
+}
+
+static void finger_off(void *data)
+{
+	struct vdev *v = data;
+	v->timeout = NULL;
+	fpi_imgdev_report_finger_status(v->imgdev, FALSE);
+}
+
+static void deactivate_done(void *data)
+{
+	struct vdev *v = data;
+	v->timeout = NULL;
+	fpi_imgdev_deactivate_complete(v->imgdev);
+}
+
+static int vdev_open(struct fp_img_dev *imgdev, unsigned long driver_data)
+{
+	struct vdev *v = (struct vdev *) driver_data;
+
+	v->imgdev = imgdev;
+	imgdev->priv = v;
+	fpi_imgdev_open_complete(imgdev, 0);
+	return 0;
+}
+
+static int vdev_activate(struct fp_img_dev *imgdev, enum fp_imgdev_state state)
+{
+	vdev_schedule(imgdev->priv, ACTIVATE_DELAY, activate_done);
+	return 0;
+}
+
+static int vdev_change_state(struct fp_img_dev *imgdev,
+	enum fp_imgdev_state state)
+{
+	struct vdev *v = imgdev->priv;
+
+	switch (state) {
+	case IMGDEV_STATE_AWAIT_FINGER_ON:
+		vdev_schedule(v, FINGER_ON_DELAY_MIN
+			+ rng() % (FINGER_ON_DELAY_MAX - FINGER_ON_DELAY_MIN),
+			finger_on);
+		break;
+	case IMGDEV_STATE_CAPTURE:
+		vdev_schedule(v, CAPTURE_DELAY, image_ready);
+		break;
+	case IMGDEV_STATE_AWAIT_FINGER_OFF:
+		/* the finger goes away at once, so results are reported as
+		 * soon as they are known */
+		vdev_schedule(v, 0, finger_off);
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void vdev_deactivate(struct fp_img_dev *imgdev)
+{
+	vdev_schedule(imgdev->priv, 0, deactivate_done);
+}
+
+static struct fp_img_driver vdev_driver = {
+	.driver = {
+		.id = 0xfff0,
+		.name = "virtual",
+		.full_name = "Virtual imaging device",
+		.scan_type = FP_SCAN_TYPE_PRESS,
+	},
+	.img_width = IMG_WIDTH,
+	.img_height = IMG_HEIGHT,
+	.open = vdev_open,
+	.activate = vdev_activate,
+	.change_state = vdev_change_state,
+	.deactivate = vdev_deactivate,
+};
+
+/* The application side */
+
+static void verify_cb(struct fp_dev *dev, int result, struct fp_img *img,
+	void *user_data);
+
+static void start(void *data)
+{
+	struct vdev *v = data;
+	int r;
+
+	r = fp_async_verify_start(v->dev, enrolled, verify_cb, v);
+	if (r < 0) {
+		fprintf(stderr, "could not start verification: %d\n", r);
+		exit(1);
+	}
+}
+
+static void verify_stopped(struct fp_dev *dev, void *user_data)
+{
+	struct vdev *v = user_data;
+
+	/* the library still updates the device once this returns, so restart
+	 * from the event loop rather than from within the callback */
+	if (v->running)
+		fpi_timeout_add(0, start, v);
+	else
+		v->verifying = 0;
+}
+
+static void restart(void *data)
+{
+	struct vdev *v = data;
+	fp_async_verify_stop(v->dev, verify_stopped, v);
+}
+
+static void verify_cb(struct fp_dev *dev, int result, struct fp_img *img,
+	void *user_data)
+{
+	struct vdev *v = user_data;
+
+	if (result < 0) {
+		fprintf(stderr, "verification failed: %d\n", result);
+		exit(1);
+	}
+	if (measuring && nr_latencies < max_latencies)
+		latencies[nr_latencies++] = now() - v->captured_at;
+	fp_img_free(img);
+
+	/* not from within the callback */
+	fpi_timeout_add(0, restart, v);
+}
+
+static void open_vdev(struct vdev *v)
+{
+	struct fp_dev *dev = g_malloc0(sizeof(*dev));
+
+	dev->drv = &vdev_driver.driver;
+	dev->__enroll_stage = -1;
+	dev->state = DEV_STATE_INITIALIZING;
+	v->dev = dev;
+	if (dev->drv->open(dev, (unsigned long) v) || !v->imgdev) {
+		fprintf(stderr, "could not open virtual device\n");
+		exit(1);
+	}
+}
+
+static void run_events(int (*done)(void))
+{
+	while (!done()) {
+		struct timeval tv = { 1, 0 };
+		int r;
+
+		if (event_fd >= 0) {
+			struct pollfd pfd = { event_fd, POLLIN, 0 };
+			r = poll(&pfd, 1, 1000);
+			if (r > 0)
+				r = fp_dispatch_events();
+		} else {
+			r = fp_handle_events_timeout(&tv);
+		}
+		if (r < 0) {
+			fprintf(stderr, "event handling failed\n");
+			exit(1);
+		}
+	}
+}
+
+static int enough_results(void)
+{
+	return nr_latencies >= max_latencies;
+}
+
+static int all_stopped(void)
+{
+	int i;
+
+	for (i = 0; i < nr_vdevs; i++)
+		if (vdevs[i].verifying)
+			return 0;
+	return 1;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double p)
+{
+	int i = (int) ceil(p / 100 * nr_latencies) - 1;
+	return latencies[i < 0 ? 0 : i];
+}
+
+int main(int argc, char **argv)
+{
+	int per_device = 20, max_devices = 64, use_event_fd = 0;
+	struct fp_img *img;
+	int ndev, i, opt, r;
+	double started, elapsed;
+
+	while ((opt = getopt(argc, argv, "en:m:")) != -1) {
+		switch (opt) {
+		case 'e':
+			use_event_fd = 1;
+			break;
+		case 'n':
+			per_device = atoi(optarg);
+			break;
+		case 'm':
+			max_devices = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-e] [-n RESULTS] [-m DEVICES]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (per_device < 1 || max_devices < 1) {
+		fprintf(stderr, "counts must be positive\n");
+		return 2;
+	}
+
+	r = fp_init();
+	if (r < 0) {
+		fprintf(stderr, "could not initialise libfprint: %d\n", r);
+		return 1;
+	}
+	fpi_img_driver_setup(&vdev_driver);
+	if (use_event_fd) {
+		event_fd = fp_get_event_fd();
+		if (event_fd < 0) {
+			fprintf(stderr, "no event fd: %d\n", event_fd);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < NR_IMAGES; i++) {
+		images[i] = g_malloc(IMG_WIDTH * IMG_HEIGHT);
+		make_image(images[i], IMG_WIDTH, IMG_HEIGHT);
+	}
+
+	vdevs = g_new0(struct vdev, max_devices);
+	latencies = g_new(double, (size_t) max_devices * per_device);
+
+	/* every device verifies against the first image */
+	open_vdev(&vdevs[0]);
+	nr_vdevs = 1;
+	img = capture_image(&vdevs[0]);
+	r = fpi_img_to_print_data(vdevs[0].imgdev, img, &enrolled);
+	fp_img_free(img);
+	if (r < 0) {
+		fprintf(stderr, "could not enroll: %d\n", r);
+		return 1;
+	}
+
+	printf("devices  results   p50 ms   p90 ms   p99 ms   max ms  results/s\n");
+	for (ndev = 1; ; ndev = MIN(ndev * 2, max_devices)) {
+		for (; nr_vdevs < ndev; nr_vdevs++)
+			open_vdev(&vdevs[nr_vdevs]);
+
+		nr_latencies = 0;
+		max_latencies = ndev * per_device;
+		measuring = 1;
+		started = now();
+		for (i = 0; i < ndev; i++) {
+			vdevs[i].running = 1;
+			vdevs[i].verifying = 1;
+			start(&vdevs[i]);
+		}
+		run_events(enough_results);
+		elapsed = now() - started;
+		measuring = 0;
+
+		qsort(latencies, nr_latencies, sizeof(double), cmp_double);
+		printf("%7d  %7d  %7.1f  %7.1f  %7.1f  %7.1f  %9.1f\n", ndev,
+			nr_latencies, percentile(50), percentile(90),
+			percentile(99), latencies[nr_latencies - 1],
+			nr_latencies * 1000.0 / elapsed);
+
+		for (i = 0; i < ndev; i++)
+			vdevs[i].running = 0;
+		run_events(all_stopped);
+		if (ndev == max_devices)
+			break;
+	}
+
+	/* virtual devices have no USB handle for fp_exit() to close, and the
+	 * process is about to end anyway */
+	return 0;
+}
@@ -66,12 +66,27 @@ identified are necessarily the best available for the purpose.
       ROUTINES:
 #cat: bozorth_probe_init -   creates the pairwise minutia comparison
 #cat:                        table for the probe fingerprint
+#cat: bozorth_probe_share -  lets another matcher context reuse the probe
+#cat:                        table built by bozorth_probe_init
 #cat: bozorth_gallery_init - creates the pairwise minutia comparison
 #cat:                        table for the gallery fingerprint
 #cat: bozorth_to_gallery -   supports the matching scenario where the
 #cat:                        same probe fingerprint is matches repeatedly
 #cat:                        to multiple gallery fingerprints as in
 #cat:                        identification mode
+#cat: bozorth_web_alloc -    allocates an empty table for a given number
+#cat:                        of rows, to be filled in by the caller
+#cat: bozorth_web_new -      builds a print's pairwise minutia comparison
+#cat:                        table once, for repeated use as a gallery
+#cat: bozorth_web_free -     releases a table built by bozorth_web_new
+#cat: bozorth_probe_web -    lets a matcher context use a table built by
+#cat:                        bozorth_web_new as the probe's
+#cat: bozorth_to_gallery_web - like bozorth_to_gallery, but matches against
+#cat:                        a table built by bozorth_web_new
+#cat: bozorth_to_gallery_threshold - like bozorth_to_gallery, but only
+#cat:                        scores as far as needed to tell whether the
+#cat:                        score reaches a given threshold
+#cat: bozorth_to_gallery_web_threshold - the same for bozorth_to_gallery_web
 #cat: bozorth_main -         supports the matching scenario where a
 #cat:                        single probe fingerprint is to be matched
 #cat:                        to a single gallery fingerprint as in
@@ -86,7 +101,7 @@ identified are necessarily the best available for the purpose.
 
 /**************************************************************************/
 
-int bozorth_probe_init( struct xyt_struct * pstruct )
+int bozorth_probe_init( struct bz_ctx * ctx, struct xyt_struct * pstruct )
 {
 int sim;	/* number of pointwise comparisons for Subject's record*/
 int msim;	/* Pruned length of Subject's comparison pointer list */
@@ -101,14 +116,15 @@ bz_comp(
 	pstruct->ycol,
 	pstruct->thetacol,
 	&sim,
-	scols,
-	scolpt );
+	ctx->scols,
+	ctx->scolpt );
 
 msim = sim;	/* Init search to end of Subject's pointwise comparison table (last edge in Web) */
 
 
 
-bz_find( &msim, scolpt );
+bz_find( &msim, ctx->scolpt );
+ctx->pcolpt = ctx->scolpt;
 
 
 
@@ -122,9 +138,22 @@ if ( msim < FDD )	/* Makes sure there are a reasonable number of edges (at least
 return msim;
 }
 
+/**************************************************************************/
+/* Lets CTX match against the Web already built in PROBE_CTX by           */
+/* bozorth_probe_init(), without rebuilding or copying it.  The Subject's */
+/* table is only ever read while matching, so any number of contexts may */
+/* share one probe, as long as PROBE_CTX outlives them and is not itself  */
+/* re-initialized in the meantime.  Pass the length returned by           */
+/* bozorth_probe_init() for PROBE_CTX on to bozorth_to_gallery().         */
+
+void bozorth_probe_share( struct bz_ctx * ctx, struct bz_ctx * probe_ctx )
+{
+ctx->pcolpt = probe_ctx->pcolpt;
+}
+
 /**************************************************************************/
 
-int bozorth_gallery_init( struct xyt_struct * gstruct )
+int bozorth_gallery_init( struct bz_ctx * ctx, struct xyt_struct * gstruct )
 {
 int fim;	/* number of pointwise comparisons for On-File record*/
 int mfim;	/* Pruned length of On-File Record's pointer list */
@@ -138,14 +167,15 @@ bz_comp(
 	gstruct->ycol,
 	gstruct->thetacol,
 	&fim,
-	fcols,
-	fcolpt );
+	ctx->fcols,
+	ctx->fcolpt );
 
 mfim = fim;	/* Init search to end of On-File Record's pointwise comparison table (last edge in Web) */
 
 
 
-bz_find( &mfim, fcolpt );
+bz_find( &mfim, ctx->fcolpt );
+ctx->gcolpt = ctx->fcolpt;
 
 
 
@@ -162,22 +192,141 @@ return mfim;
 /**************************************************************************/
 
 int bozorth_to_gallery(
+		struct bz_ctx * ctx,
 		int probe_len,
 		struct xyt_struct * pstruct,
 		struct xyt_struct * gstruct
 		)
 {
+return bozorth_to_gallery_threshold( ctx, probe_len, pstruct, gstruct, 0 );
+}
+
+/**************************************************************************/
+/* See bz_match_score_threshold() for what the score returned means.      */
+
+int bozorth_to_gallery_threshold(
+		struct bz_ctx * ctx,
+		int probe_len,
+		struct xyt_struct * pstruct,
+		struct xyt_struct * gstruct,
+		int threshold
+		)
+{
 int np;
 int gallery_len;
 
-gallery_len = bozorth_gallery_init( gstruct );
-np = bz_match( probe_len, gallery_len );
-return bz_match_score( np, pstruct, gstruct );
+gallery_len = bozorth_gallery_init( ctx, gstruct );
+np = bz_match( ctx, probe_len, gallery_len );
+return bz_match_score_threshold( ctx, np, pstruct, gstruct, threshold );
+}
+
+/**************************************************************************/
+/* Allocates an empty Web with room for NROWS rows, for callers that have */
+/* the rows from elsewhere (e.g. a stored template).  The rows must be   */
+/* filled in by the caller, in sorted order.  Returns BZ_WEB_NULL on     */
+/* error.                                                                 */
+
+struct bz_web * bozorth_web_alloc( int nrows )
+{
+struct bz_web * web;
+int i;
+
+web = (struct bz_web *) malloc_or_return_error( sizeof( struct bz_web )
+			+ nrows * ( sizeof( bz_tab_t * ) + sizeof( bz_tab_t [ COLS_SIZE_2 ] ) ),
+			"gallery web" );
+if ( web == BZ_WEB_NULL )
+	return BZ_WEB_NULL;
+
+web->nrows = nrows;
+web->colpt = (bz_tab_t **) ( web + 1 );
+web->cols  = (bz_tab_t (*)[ COLS_SIZE_2 ]) ( web->colpt + nrows );
+
+for ( i = 0; i < nrows; i++ )
+	web->colpt[i] = web->cols[i];
+
+return web;
+}
+
+/**************************************************************************/
+/* Builds the On-File Record's Web using CTX as scratch space, and copies */
+/* the part of it that match() looks at out into a single heap block.     */
+/* Returns BZ_WEB_NULL on error.                                          */
+
+struct bz_web * bozorth_web_new( struct bz_ctx * ctx, struct xyt_struct * gstruct )
+{
+struct bz_web * web;
+int len;
+int i;
+
+len = bozorth_gallery_init( ctx, gstruct );
+
+web = bozorth_web_alloc( len );
+if ( web == BZ_WEB_NULL )
+	return BZ_WEB_NULL;
+
+for ( i = 0; i < len; i++ )
+	memcpy( web->cols[i], ctx->fcolpt[i], sizeof( web->cols[i] ) );
+
+return web;
+}
+
+/**************************************************************************/
+
+void bozorth_web_free( struct bz_web * web )
+{
+free( (void *) web );
+}
+
+/**************************************************************************/
+/* The Subject's Web is built exactly as the On-File Record's is, so a    */
+/* Web from bozorth_web_new() can stand in for bozorth_probe_init().      */
+/* Like bozorth_probe_share(), this only points CTX at WEB, which must    */
+/* outlive its use.  Returns the probe length to pass on to               */
+/* bozorth_to_gallery() and friends.                                      */
+
+int bozorth_probe_web( struct bz_ctx * ctx, struct bz_web * web )
+{
+ctx->pcolpt = web->colpt;
+return web->nrows;
+}
+
+/**************************************************************************/
+
+int bozorth_to_gallery_web(
+		struct bz_ctx * ctx,
+		int probe_len,
+		struct xyt_struct * pstruct,
+		struct xyt_struct * gstruct,
+		struct bz_web * web
+		)
+{
+return bozorth_to_gallery_web_threshold( ctx, probe_len, pstruct, gstruct, web, 0 );
+}
+
+/**************************************************************************/
+/* See bz_match_score_threshold() for what the score returned means.      */
+
+int bozorth_to_gallery_web_threshold(
+		struct bz_ctx * ctx,
+		int probe_len,
+		struct xyt_struct * pstruct,
+		struct xyt_struct * gstruct,
+		struct bz_web * web,
+		int threshold
+		)
+{
+int np;
+
+ctx->gcolpt = web->colpt;
+np = bz_match( ctx, probe_len, web->nrows );
+ctx->gcolpt = ctx->fcolpt;
+return bz_match_score_threshold( ctx, np, pstruct, gstruct, threshold );
 }
 
 /**************************************************************************/
 
 int bozorth_main(
+		struct bz_ctx * ctx,
 		struct xyt_struct * pstruct,
 		struct xyt_struct * gstruct
 		)
@@ -192,26 +341,26 @@ int gallery_len;
 #ifdef DEBUG
 	printf( "PROBE_INIT() called\n" );
 #endif
-probe_len   = bozorth_probe_init( pstruct );
+probe_len   = bozorth_probe_init( ctx, pstruct );
 
 
 #ifdef DEBUG
 	printf( "GALLERY_INIT() called\n" );
 #endif
-gallery_len = bozorth_gallery_init( gstruct );
+gallery_len = bozorth_gallery_init( ctx, gstruct );
 
 
 #ifdef DEBUG
 	printf( "BZ_MATCH() called\n" );
 #endif
-np = bz_match( probe_len, gallery_len );
+np = bz_match( ctx, probe_len, gallery_len );
 
 
 #ifdef DEBUG
 	printf( "BZ_MATCH() returned %d edge pairs\n", np );
 	printf( "COMPUTE() called\n" );
 #endif
-ms = bz_match_score( np, pstruct, gstruct );
+ms = bz_match_score( ctx, np, pstruct, gstruct );
 
 
 #ifdef DEBUG
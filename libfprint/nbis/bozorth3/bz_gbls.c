@@ -58,56 +58,47 @@ identified are necessarily the best available for the purpose.
                       Stan Janet (NIST)
       DATE:           09/21/2004
 
-      Contains global variables responsible for supporting the
+      Contains the routines responsible for allocating and releasing
+      the working state (formerly a set of global variables) of the
       Bozorth3 fingerprint matching "core" algorithm.
 
 ***********************************************************************
-***********************************************************************/
-
-#include <bozorth.h>
-
-/**************************************************************************/
-/* General supporting global variables */
-/**************************************************************************/
-
-int colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];		/* Output from match(), this is a sorted table of compatible edge pairs containing: */
-						/*	DeltaThetaKJs, Subject's K, J, then On-File's {K,J} or {J,K} depending */
-						/* Sorted first on Subject's point index K, */
-						/*	then On-File's K or J point index (depending), */
-						/*	lastly on Subject's J point index */
-int scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];	/* Subject's pointwise comparison table containing: */
-						/*	Distance,min(BetaK,BetaJ),max(BetaK,BbetaJ), K,J,ThetaKJ */
-int fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];	/* On-File Record's pointwise comparison table with: */
-						/*	Distance,min(BetaK,BetaJ),max(BetaK,BbetaJ),K,J, ThetaKJ */
-int * scolpt[ SCOLPT_SIZE ];			/* Subject's list of pointers to pointwise comparison rows, sorted on: */
-						/*	Distance, min(BetaK,BetaJ), then max(BetaK,BetaJ) */
-int * fcolpt[ FCOLPT_SIZE ];			/* On-File Record's list of pointers to pointwise comparison rows sorted on: */
-						/*	Distance, min(BetaK,BetaJ), then max(BetaK,BetaJ) */
-int sc[ SC_SIZE ];				/* Flags all compatible edges in the Subject's Web */
-
-int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
-
 
-/**************************************************************************/
-/* Globals used significantly by sift() */
-/**************************************************************************/
-int rq[ RQ_SIZE ] = {};
-int tq[ TQ_SIZE ] = {};
-int zz[ ZZ_SIZE ] = {};
+      ROUTINES:
+#cat: bz_ctx_new -  allocates a zero-initialized matcher context
+#cat: bz_ctx_free - releases a matcher context
 
-int rx[ RX_SIZE ] = {};
-int mm[ MM_SIZE ] = {};
-int nn[ NN_SIZE ] = {};
-
-int qq[ QQ_SIZE ] = {};
-
-int rk[ RK_SIZE ] = {};
-
-int cp[ CP_SIZE ] = {};
-int rp[ RP_SIZE ] = {};
-
-int rf[RF_SIZE_1][RF_SIZE_2] = {};
-int cf[CF_SIZE_1][CF_SIZE_2] = {};
+***********************************************************************/
 
-int y[20000] = {};
+#include <stdio.h>
+#include <string.h>
+#include <bozorth.h>
 
+/***********************************************************************/
+/* returns BZ_CTX_NULL on error */
+struct bz_ctx * bz_ctx_new( void )
+{
+struct bz_ctx * ctx;
+
+/* The context is far too large for the stack, and the algorithm relies  */
+/* on some of its tables starting out zeroed, as the globals it replaces */
+/* used to be.                                                            */
+ctx = (struct bz_ctx *) calloc( 1, sizeof(struct bz_ctx) );
+if ( ctx == BZ_CTX_NULL ) {
+	fprintf( stderr, "%s: ERROR: calloc() of %lu bytes for matcher context failed: %s\n",
+						get_progname(),
+						(unsigned long) sizeof(struct bz_ctx),
+						strerror( errno )
+						);
+	return BZ_CTX_NULL;
+}
+ctx->pcolpt = ctx->scolpt;
+ctx->gcolpt = ctx->fcolpt;
+return ctx;
+}
+
+/***********************************************************************/
+void bz_ctx_free( struct bz_ctx * ctx )
+{
+free( (void *) ctx );
+}
@@ -0,0 +1,210 @@
+/******************************************************************************
+
+This file is part of the Export Control subset of the United States NIST
+Biometric Image Software (NBIS) distribution:
+    http://fingerprint.nist.gov/NBIS/index.html
+
+It is our understanding that this falls within ECCN 3D980, which covers
+software associated with the development, production or use of certain
+equipment controlled in accordance with U.S. concerns about crime control
+practices in specific countries.
+
+Therefore, this file should not be exported, or made available on fileservers,
+except as allowed by U.S. export control laws.
+
+Do not remove this notice.
+
+******************************************************************************/
+
+/* NOTE: Despite the above notice (which I have not removed), this file is
+ * being legally distributed within libfprint; the U.S. Export Administration
+ * Regulations do not place export restrictions upon distribution of
+ * "publicly available technology and software", as stated in EAR section
+ * 734.3(b)(3)(i). libfprint qualifies as publicly available technology as per
+ * the definition in section 734.7(a)(1).
+ *
+ * For further information, see http://reactivated.net/fprint/US_export_control
+ */
+
+/***********************************************************************
+      LIBRARY: FING - NIST Fingerprint Systems Utilities
+
+      FILE:           BZ_GEOM.C
+
+      Contains the pairwise minutia geometry used by bz_comp() to build
+      a print's Web: distances between one minutia and a run of
+      others, computed several pairs at a time where the CPU allows,
+      and the angle of the line joining two minutiae, looked up from a
+      table instead of calling atanf() for every pair.
+
+      Both produce exactly the values the original scalar code in
+      bz_comp() did.  The table is filled in by that very code, and
+      the vector kernels only do integer arithmetic.
+
+***********************************************************************
+
+      ROUTINES:
+#cat: bz_geom_init - fills in the angle table and picks the distance
+#cat:            kernel best suited to the CPU; safe to call any
+#cat:            number of times from any thread
+#cat: bz_theta_kj - returns the rounded angle, in degrees, of the line
+#cat:            from one minutia to another less than DM away
+#cat: bz_distances - computes the X and Y offsets and the squared
+#cat:            distances from one minutia to a run of others
+
+***********************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <bozorth.h>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define BZ_GEOM_X86
+#include <immintrin.h>
+#endif
+
+/* Offsets within DM of each other index the table directly; signed char */
+/* is enough for angles in [ -90, 90 ].                                   */
+#define THETA_DIM	( 2 * DM + 1 )
+
+static signed char theta_table[ THETA_DIM ][ THETA_DIM ];
+
+static pthread_once_t geom_once = PTHREAD_ONCE_INIT;
+
+typedef void ( * distances_fn )( int, const int *, const int *, int, int,
+					int *, int *, int * );
+static distances_fn distances_impl;
+
+/***********************************************************************/
+/* The reference angle computation, exactly as bz_comp() had it inline */
+static int theta_kj_scalar( int dx, int dy )
+{
+double dz;
+
+if ( dx == 0 )
+	return 90;
+
+dz = ( 180.0F / PI_SINGLE ) * atanf( (float) dy / (float) dx );
+if ( dz < 0.0F )
+	dz -= 0.5F;
+else
+	dz += 0.5F;
+return (int) dz;
+}
+
+/***********************************************************************/
+static void distances_scalar( int n, const int * xcol, const int * ycol,
+			int xk, int yk, int * dx, int * dy, int * dist )
+{
+int i;
+
+for ( i = 0; i < n; i++ ) {
+	dx[i] = xcol[i] - xk;
+	dy[i] = ycol[i] - yk;
+	dist[i] = SQUARED(dx[i]) + SQUARED(dy[i]);
+}
+}
+
+#ifdef BZ_GEOM_X86
+/***********************************************************************/
+/* SSE2 has no 32-bit low multiply; build one from two 32x32->64 ones. */
+/* The low halves are what the scalar int multiply produces.           */
+__attribute__((target("sse2")))
+static __m128i mullo_epi32_sse2( __m128i a, __m128i b )
+{
+__m128i even = _mm_mul_epu32( a, b );
+__m128i odd  = _mm_mul_epu32( _mm_srli_si128( a, 4 ), _mm_srli_si128( b, 4 ) );
+
+return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ),
+			_mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+/***********************************************************************/
+__attribute__((target("sse2")))
+static void distances_sse2( int n, const int * xcol, const int * ycol,
+			int xk, int yk, int * dx, int * dy, int * dist )
+{
+__m128i vxk = _mm_set1_epi32( xk );
+__m128i vyk = _mm_set1_epi32( yk );
+int i;
+
+for ( i = 0; i + 4 <= n; i += 4 ) {
+	__m128i vdx = _mm_sub_epi32( _mm_loadu_si128( (const __m128i *) &xcol[i] ), vxk );
+	__m128i vdy = _mm_sub_epi32( _mm_loadu_si128( (const __m128i *) &ycol[i] ), vyk );
+	__m128i vd  = _mm_add_epi32( mullo_epi32_sse2( vdx, vdx ),
+				mullo_epi32_sse2( vdy, vdy ) );
+
+	_mm_storeu_si128( (__m128i *) &dx[i], vdx );
+	_mm_storeu_si128( (__m128i *) &dy[i], vdy );
+	_mm_storeu_si128( (__m128i *) &dist[i], vd );
+}
+
+distances_scalar( n - i, xcol + i, ycol + i, xk, yk, dx + i, dy + i, dist + i );
+}
+
+/***********************************************************************/
+__attribute__((target("avx2")))
+static void distances_avx2( int n, const int * xcol, const int * ycol,
+			int xk, int yk, int * dx, int * dy, int * dist )
+{
+__m256i vxk = _mm256_set1_epi32( xk );
+__m256i vyk = _mm256_set1_epi32( yk );
+int i;
+
+for ( i = 0; i + 8 <= n; i += 8 ) {
+	__m256i vdx = _mm256_sub_epi32( _mm256_loadu_si256( (const __m256i *) &xcol[i] ), vxk );
+	__m256i vdy = _mm256_sub_epi32( _mm256_loadu_si256( (const __m256i *) &ycol[i] ), vyk );
+	__m256i vd  = _mm256_add_epi32( _mm256_mullo_epi32( vdx, vdx ),
+				_mm256_mullo_epi32( vdy, vdy ) );
+
+	_mm256_storeu_si256( (__m256i *) &dx[i], vdx );
+	_mm256_storeu_si256( (__m256i *) &dy[i], vdy );
+	_mm256_storeu_si256( (__m256i *) &dist[i], vd );
+}
+
+distances_scalar( n - i, xcol + i, ycol + i, xk, yk, dx + i, dy + i, dist + i );
+}
+#endif
+
+/***********************************************************************/
+static void geom_init_once( void )
+{
+int dx, dy;
+
+for ( dx = -DM; dx <= DM; dx++ )
+	for ( dy = -DM; dy <= DM; dy++ )
+		theta_table[ dx + DM ][ dy + DM ] = (signed char) theta_kj_scalar( dx, dy );
+
+distances_impl = distances_scalar;
+#ifdef BZ_GEOM_X86
+__builtin_cpu_init();
+if ( __builtin_cpu_supports( "avx2" ) )
+	distances_impl = distances_avx2;
+else if ( __builtin_cpu_supports( "sse2" ) )
+	distances_impl = distances_sse2;
+#endif
+}
+
+/***********************************************************************/
+void bz_geom_init( void )
+{
+pthread_once( &geom_once, geom_init_once );
+}
+
+/***********************************************************************/
+/* DX and DY must both lie within [ -DM, DM ], as they do for any pair  */
+/* of minutiae no further than DM apart.  Requires bz_geom_init().     */
+int bz_theta_kj( int dx, int dy )
+{
+return theta_table[ dx + DM ][ dy + DM ];
+}
+
+/***********************************************************************/
+/* For each of the N minutiae in XCOL/YCOL, stores its offset from      */
+/* (XK,YK) in DX/DY and the squared length of that offset in DIST.     */
+/* Requires bz_geom_init().                                            */
+void bz_distances( int n, const int * xcol, const int * ycol, int xk, int yk,
+			int * dx, int * dy, int * dist )
+{
+distances_impl( n, xcol, ycol, xk, yk, dx, dy, dist );
+}
@@ -71,10 +71,15 @@ identified are necessarily the best available for the purpose.
 #cat:            then on y
 #cat: sort_order_decreasing - calls a custom quicksort that sorts
 #cat:            a list of integers in decreasing order
+#cat: sort_cols - orders the rows of a pointwise comparison table on
+#cat:            distance, then min beta, then max beta, keeping
+#cat:            rows with equal keys in table order
 
 ***********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <bozorth.h>
 
 /* These are now externally defined in bozorth.h */
@@ -313,3 +318,103 @@ free( (void *) cells );
 
 return 0;
 }
+
+/***********************************************************************/
+/* The three sort fields of a pointwise comparison row packed into one   */
+/* unsigned key that compares the same way: distance is in [ 0, DM^2 ]  */
+/* (14 bits) and both betas are in ( -180, 180 ] (9 bits once biased).  */
+#define COLS_KEY(row)	( ( (unsigned int) (row)[0] << 18 ) \
+			| ( (unsigned int) ( (row)[1] + 180 ) << 9 ) \
+			| (unsigned int) ( (row)[2] + 180 ) )
+
+#define RADIX_BITS	8
+#define RADIX_SIZE	( 1 << RADIX_BITS )
+#define RADIX_PASSES	( 32 / RADIX_BITS )
+
+/***********************************************************************/
+/* Fallback for when no scratch space can be had: a plain insertion sort */
+/* on the pointer list, which is stable like the radix sort.            */
+static void sort_cols_insertion( int ncols, bz_tab_t cols[][ COLS_SIZE_2 ], bz_tab_t * colptrs[] )
+{
+int i, j;
+
+for ( i = 0; i < ncols; i++ ) {
+	unsigned int key = COLS_KEY( cols[i] );
+
+	for ( j = i; j > 0 && COLS_KEY( colptrs[j-1] ) > key; j-- )
+		colptrs[j] = colptrs[j-1];
+	colptrs[j] = &cols[i][0];
+}
+}
+
+/***********************************************************************/
+/* Fills COLPTRS with pointers to the NCOLS rows of COLS, ordered on     */
+/* distance, min(BetaK,BetaJ) and max(BetaK,BetaJ), rows with identical  */
+/* keys keeping their order in COLS.  This is the order bz_comp() used   */
+/* to build by binary insertion, at a fraction of the cost: the keys are */
+/* small bounded integers, so a stable LSD radix sort does the job in a  */
+/* few linear passes.                                                    */
+void sort_cols( int ncols, bz_tab_t cols[][ COLS_SIZE_2 ], bz_tab_t * colptrs[] )
+{
+unsigned int * scratch;
+unsigned int * keys;
+unsigned int * tkeys;
+int * rows;
+int * trows;
+int count[ RADIX_SIZE ];
+int pass, i;
+
+if ( ncols <= 0 )
+	return;
+
+scratch = (unsigned int *) malloc( 2 * ncols * ( sizeof( unsigned int ) + sizeof( int ) ) );
+if ( scratch == (unsigned int *) NULL ) {
+	sort_cols_insertion( ncols, cols, colptrs );
+	return;
+}
+keys  = scratch;
+tkeys = keys + ncols;
+rows  = (int *) ( tkeys + ncols );
+trows = rows + ncols;
+
+for ( i = 0; i < ncols; i++ ) {
+	keys[i] = COLS_KEY( cols[i] );
+	rows[i] = i;
+}
+
+for ( pass = 0; pass < RADIX_PASSES; pass++ ) {
+	int shift = pass * RADIX_BITS;
+	unsigned int * swapk;
+	int * swapr;
+	int sum;
+
+	memset( count, 0, sizeof( count ) );
+	for ( i = 0; i < ncols; i++ )
+		count[ ( keys[i] >> shift ) & ( RADIX_SIZE - 1 ) ]++;
+
+					/* All keys share this digit, nothing to reorder */
+	if ( count[ ( keys[0] >> shift ) & ( RADIX_SIZE - 1 ) ] == ncols )
+		continue;
+
+	sum = 0;
+	for ( i = 0; i < RADIX_SIZE; i++ ) {
+		int c = count[i];
+		count[i] = sum;
+		sum += c;
+	}
+
+	for ( i = 0; i < ncols; i++ ) {
+		int pos = count[ ( keys[i] >> shift ) & ( RADIX_SIZE - 1 ) ]++;
+		tkeys[pos] = keys[i];
+		trows[pos] = rows[i];
+	}
+
+	swapk = keys; keys = tkeys; tkeys = swapk;
+	swapr = rows; rows = trows; trows = swapr;
+}
+
+for ( i = 0; i < ncols; i++ )
+	colptrs[i] = &cols[ rows[i] ][0];
+
+free( (void *) scratch );
+}
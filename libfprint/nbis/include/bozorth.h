@@ -177,6 +177,102 @@ struct xyt_struct {
 #define XYT_NULL ( (struct xyt_struct *) NULL ) /* bz_load() */
 
 
+/**************************************************************************/
+/* Element type of the matcher's tables and of a Web's rows.  All they    */
+/* ever hold -- squared distances up to DM^2, angles, ThetaKJ + 400,      */
+/* point indices, row and group numbers below 20000 -- fits in 16 bits,   */
+/* which halves the memory a match walks through.  Define BZ_WIDE_TABLES  */
+/* to build with the original int tables, e.g. to compare the two.        */
+/**************************************************************************/
+#ifdef BZ_WIDE_TABLES
+typedef int bz_tab_t;
+#else
+typedef short bz_tab_t;
+#endif
+
+/**************************************************************************/
+/* In BZ_GBLS.C : Working state of a single match */
+/**************************************************************************/
+/* Everything the "core" bozorth algorithm modifies while matching lives  */
+/* in one of these, so independent matches may run concurrently as long  */
+/* as each has its own context.  Allocate with bz_ctx_new().              */
+struct bz_ctx {
+	/* Arrays supporting "core" bozorth algorithm */
+	bz_tab_t colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];	/* Output from match(), this is a sorted table of compatible edge pairs containing: */
+						/*	DeltaThetaKJs, Subject's K, J, then On-File's {K,J} or {J,K} depending */
+						/* Sorted first on Subject's point index K, */
+						/*	then On-File's K or J point index (depending), */
+						/*	lastly on Subject's J point index */
+	bz_tab_t scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];	/* Subject's pointwise comparison table containing: */
+						/*	Distance,min(BetaK,BetaJ),max(BetaK,BbetaJ), K,J,ThetaKJ */
+	bz_tab_t fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];	/* On-File Record's pointwise comparison table with: */
+						/*	Distance,min(BetaK,BetaJ),max(BetaK,BbetaJ),K,J, ThetaKJ */
+	bz_tab_t * scolpt[ SCOLPT_SIZE ];	/* Subject's list of pointers to pointwise comparison rows, sorted on: */
+						/*	Distance, min(BetaK,BetaJ), then max(BetaK,BetaJ) */
+	bz_tab_t * fcolpt[ FCOLPT_SIZE ];	/* On-File Record's list of pointers to pointwise comparison rows sorted on: */
+						/*	Distance, min(BetaK,BetaJ), then max(BetaK,BetaJ) */
+	bz_tab_t ** pcolpt;			/* Subject's row-pointer list actually read by match(); normally scolpt, */
+						/*	but may be another context's list, see bozorth_probe_share() */
+	bz_tab_t ** gcolpt;			/* On-File Record's row-pointer list actually read by match(); normally */
+						/*	fcolpt, but may be a precomputed Web, see bozorth_to_gallery_web() */
+	int sc[ SC_SIZE ];			/* Flags all compatible edges in the Subject's Web */
+
+	int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
+
+	/* Used significantly by sift() */
+	int rq[ RQ_SIZE ];
+	int tq[ TQ_SIZE ];
+	int zz[ ZZ_SIZE ];
+
+	int rx[ RX_SIZE ];
+	int mm[ MM_SIZE ];
+	int nn[ NN_SIZE ];
+
+	int qq[ QQ_SIZE ];
+
+	int rk[ RK_SIZE ];
+
+	int cp[ CP_SIZE ];
+	int rp[ RP_SIZE ];
+
+	bz_tab_t rf[ RF_SIZE_1 ][ RF_SIZE_2 ];
+	bz_tab_t cf[ CF_SIZE_1 ][ CF_SIZE_2 ];
+
+	bz_tab_t y[ Y_SIZE ];
+
+	/* Formerly static to bz_match() */
+	bz_tab_t rot[ ROT_SIZE_1 ][ ROT_SIZE_2 ];
+	bz_tab_t * rtp[ ROT_SIZE_1 ];
+
+	/* Formerly static, only used between bz_match_score() & bz_final_loop() */
+	int ct[ CT_SIZE ];
+	int gct[ GCT_SIZE ];
+	int ctt[ CTT_SIZE ];
+	bz_tab_t ctp[ CTP_SIZE_1 ][ CTP_SIZE_2 ];
+	bz_tab_t yy[ YY_SIZE_1 ][ YY_SIZE_2 ][ YY_SIZE_3 ];
+
+	/* Formerly static to bz_final_loop() */
+	bz_tab_t sct[ SCT_SIZE_1 ][ SCT_SIZE_2 ];
+};
+
+#define BZ_CTX_NULL ( (struct bz_ctx *) NULL )
+
+/**************************************************************************/
+/* In BZ_DRVRS.C : A print's precomputed Web */
+/**************************************************************************/
+/* The sorted and trimmed pointwise comparison table of one print, kept   */
+/* apart from any context so that an On-File Record which is matched over */
+/* and over need only have its Web built once.                            */
+struct bz_web {
+	int nrows;				/* Rows kept after bz_find() trimming */
+	bz_tab_t ** colpt;			/* Pointers to those rows, as match() expects */
+	bz_tab_t ( * cols )[ COLS_SIZE_2 ];	/* The rows themselves, in sorted order: */
+						/*	Distance,min(BetaK,BetaJ),max(BetaK,BetaJ),K,J,ThetaKJ */
+};
+
+#define BZ_WEB_NULL ( (struct bz_web *) NULL )
+
+
 /**************************************************************************/
 /**************************************************************************/
                            /* GLOBAL VARIABLES */
@@ -188,49 +284,48 @@ struct xyt_struct {
 /* Globals supporting command line options */
 extern int verbose_threshold;
 
-/**************************************************************************/
-/* In: BZ_GBLS.C */
-/**************************************************************************/
-/* Global arrays supporting "core" bozorth algorithm */
-extern int colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];
-extern int scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];
-extern int fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];
-extern int * scolpt[ SCOLPT_SIZE ];
-extern int * fcolpt[ FCOLPT_SIZE ];
-extern int sc[ SC_SIZE ];
-extern int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
-/* Global arrays supporting "core" bozorth algorithm continued: */
-/*    Globals used significantly by sift() */
-extern int rq[ RQ_SIZE ];
-extern int tq[ TQ_SIZE ];
-extern int zz[ ZZ_SIZE ];
-extern int rx[ RX_SIZE ];
-extern int mm[ MM_SIZE ];
-extern int nn[ NN_SIZE ];
-extern int qq[ QQ_SIZE ];
-extern int rk[ RK_SIZE ];
-extern int cp[ CP_SIZE ];
-extern int rp[ RP_SIZE ];
-extern int rf[RF_SIZE_1][RF_SIZE_2];
-extern int cf[CF_SIZE_1][CF_SIZE_2];
-extern int y[20000];
-
 /**************************************************************************/
 /**************************************************************************/
 /* ROUTINE PROTOTYPES */
 /**************************************************************************/
 /* In: BZ_DRVRS.C */
-extern int bozorth_probe_init( struct xyt_struct *);
-extern int bozorth_gallery_init( struct xyt_struct *);
-extern int bozorth_to_gallery(int, struct xyt_struct *, struct xyt_struct *);
-extern int bozorth_main(struct xyt_struct *, struct xyt_struct *);
+extern int bozorth_probe_init(struct bz_ctx *, struct xyt_struct *);
+extern void bozorth_probe_share(struct bz_ctx *, struct bz_ctx *);
+extern int bozorth_gallery_init(struct bz_ctx *, struct xyt_struct *);
+extern int bozorth_to_gallery(struct bz_ctx *, int, struct xyt_struct *,
+                    struct xyt_struct *);
+extern int bozorth_main(struct bz_ctx *, struct xyt_struct *,
+                    struct xyt_struct *);
+extern struct bz_web *bozorth_web_alloc(int);
+extern struct bz_web *bozorth_web_new(struct bz_ctx *, struct xyt_struct *);
+extern void bozorth_web_free(struct bz_web *);
+extern int bozorth_probe_web(struct bz_ctx *, struct bz_web *);
+extern int bozorth_to_gallery_web(struct bz_ctx *, int, struct xyt_struct *,
+                    struct xyt_struct *, struct bz_web *);
+extern int bozorth_to_gallery_threshold(struct bz_ctx *, int,
+                    struct xyt_struct *, struct xyt_struct *, int);
+extern int bozorth_to_gallery_web_threshold(struct bz_ctx *, int,
+                    struct xyt_struct *, struct xyt_struct *, struct bz_web *,
+                    int);
 /* In: BOZORTH3.C */
-extern void bz_comp(int, int [], int [], int [], int *, int [][COLS_SIZE_2],
-                    int *[]);
-extern void bz_find(int *, int *[]);
-extern int bz_match(int, int);
-extern int bz_match_score(int, struct xyt_struct *, struct xyt_struct *);
-extern void bz_sift(int *, int, int *, int, int, int, int *, int *);
+extern void bz_comp(int, int [], int [], int [], int *,
+                    bz_tab_t [][COLS_SIZE_2], bz_tab_t *[]);
+extern void bz_find(int *, bz_tab_t *[]);
+extern int bz_match(struct bz_ctx *, int, int);
+extern int bz_match_score(struct bz_ctx *, int, struct xyt_struct *,
+                    struct xyt_struct *);
+extern int bz_match_score_threshold(struct bz_ctx *, int, struct xyt_struct *,
+                    struct xyt_struct *, int);
+extern void bz_sift(struct bz_ctx *, int *, int, int *, int, int, int, int *,
+                    int *);
+/* In: BZ_GBLS.C */
+extern struct bz_ctx *bz_ctx_new(void);
+extern void bz_ctx_free(struct bz_ctx *);
+/* In: BZ_GEOM.C */
+extern void bz_geom_init(void);
+extern int bz_theta_kj(int, int);
+extern void bz_distances(int, const int *, const int *, int, int, int *,
+                    int *, int *);
 /* In: BZ_ALLOC.C */
 extern char *malloc_or_exit(int, const char *);
 extern char *malloc_or_return_error(int, const char *);
@@ -252,5 +347,6 @@ extern int fd_readable(int);
 extern int sort_quality_decreasing(const void *, const void *);
 extern int sort_x_y(const void *, const void *);
 extern int sort_order_decreasing(int [], int, int []);
+extern void sort_cols(int, bz_tab_t [][COLS_SIZE_2], bz_tab_t *[]);
 
 #endif /* !_BOZORTH_H */
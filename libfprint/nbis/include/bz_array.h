@@ -92,6 +92,11 @@ rp[x] == ctp[][x] :: sct[x][]
 
 
 
+#define ROT_SIZE_1 20000
+#define ROT_SIZE_2 5
+
+
+
 
 
 
@@ -118,6 +118,7 @@ typedef struct rotgrids{
    int ngrids;
    int grid_w;
    int grid_h;
+   int max_offset;   /* Largest offset in any of the grids. */
    int **grids;
 } ROTGRIDS;
 
@@ -242,6 +243,27 @@ typedef struct lfsparms{
    int    max_ridge_steps;
 } LFSPARMS;
 
+/* Lookup tables that depend only on the LFS parameters and the image   */
+/* dimensions.  They can be built once with init_lfs_tables() and then  */
+/* reused to process any number of images of the same dimensions.       */
+typedef struct lfstables{
+   int iw;
+   int ih;
+   const LFSPARMS *lfsparms;
+   int maxpad;
+   DIR2RAD *dir2rad;
+   DFTWAVES *dftwaves;
+   ROTGRIDS *dftgrids;
+   ROTGRIDS *dirbingrids;
+} LFSTABLES;
+
+/* Hook through which LFS may spread independent tasks over several     */
+/* threads.  A runner must call task(arg, i) exactly once for each i in */
+/* [0, ntasks), in any order and from any thread, and only return once  */
+/* all of them have.  See set_lfs_runner().                             */
+typedef void (*LFS_TASK)(void *, const int);
+typedef void (*LFS_RUNNER)(LFS_TASK, void *, const int);
+
 /*************************************************************************/
 /*        LFS CONSTANT DEFINITIONS                                       */
 /*************************************************************************/
@@ -693,6 +715,7 @@ extern int binarize_image_V2(unsigned char **, int *, int *,
                      const int *, const int, const int,
                      const int, const ROTGRIDS *);
 extern int dirbinarize(const unsigned char *, const int, const ROTGRIDS *);
+extern void set_binar_simd(const int);
 
 /* block.c */
 extern int block_offsets(int **, int *, int *, const int, const int,
@@ -733,7 +756,8 @@ extern int get_minutiae(MINUTIAE **, int **, int **, int **,
                  int **, int **, int *, int *,
                  unsigned char **, int *, int *, int *,
                  unsigned char *, const int, const int,
-                 const int, const double, const LFSPARMS *);
+                 const int, const double, const LFSPARMS *,
+                 const LFSTABLES *);
 
 /* dft.c */
 extern int dft_dir_powers(double **, unsigned char *, const int,
@@ -741,11 +765,13 @@ extern int dft_dir_powers(double **, unsigned char *, const int,
                      const ROTGRIDS *);
 extern int dft_power_stats(int *, double *, int *, double *, double **,
                      const int, const int, const int);
+extern void set_dft_simd(const int);
 
 /* free.c */
 extern void free_dir2rad(DIR2RAD *);
 extern void free_dftwaves(DFTWAVES *);
 extern void free_rotgrids(ROTGRIDS *);
+extern void free_lfs_tables(LFSTABLES *);
 extern void free_dir_powers(double **, const int);
 
 /* imgutil.c */
@@ -769,6 +795,8 @@ extern int init_dftwaves(DFTWAVES **, const double *, const int, const int);
 extern int get_max_padding_V2(const int, const int, const int, const int);
 extern int init_rotgrids(ROTGRIDS **, const int, const int, const int,
                      const double, const int, const int, const int, const int);
+extern int init_lfs_tables(LFSTABLES **, const int, const int,
+                     const LFSPARMS *);
 extern int alloc_dir_powers(double ***, const int, const int);
 extern int alloc_power_stats(int **, double **, int **, double **, const int);
 
@@ -1017,6 +1045,8 @@ extern double angle2line(const int, const int, const int, const int);
 extern int line2direction(const int, const int, const int, const int,
                      const int);
 extern int closest_dir_dist(const int, const int, const int);
+extern void set_lfs_runner(LFS_RUNNER);
+extern LFS_RUNNER get_lfs_runner(void);
 
 /*************************************************************************/
 /*        EXTERNAL GLOBAL VARIABLE DEFINITIONS                           */
@@ -34,18 +34,77 @@ identified are necessarily the best available for the purpose.
       on an arbitrarily-sized image and its precomputed direcitonal ridge
       flow (IMAP) as part of the NIST Latent Fingerprint System (LFS).
 
+      Image rows are binarized in groups which may be spread over
+      several threads with set_lfs_runner().  Where the CPU supports
+      AVX2, runs of pixels sharing a direction are binarized by a
+      vector kernel, eight at a time.  Grid sums are exact integers,
+      so the results are identical to those of dirbinarize().
+
 ***********************************************************************
                ROUTINES:
                         binarize_V2()
 			binarize_image_V2()
                         dirbinarize()
+                        set_binar_simd()
+                        binarize_rows()
+                        binarize_task()
+                        dirbin_center_row()
+                        dirbin_pixel()
+                        dirbin_runs_avx2()
 
 ***********************************************************************/
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <lfs.h>
 
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define BINAR_X86
+#include <immintrin.h>
+#endif
+
+/* Number of image rows in each of the tasks binarize_image_V2() hands */
+/* to the LFS runner.                                                  */
+#define BINAR_TASK_ROWS    16
+
+/* Number of adjacent pixels binarized at once by the vector kernel. */
+#define BINAR_RUN           8
+
+/* Binarizes two runs of BINAR_RUN pixels, the first at pptr0 along */
+/* grid0 into bptr0, the second at pptr1 along grid1 into bptr1.    */
+typedef void (*dirbin_runs_fn)(unsigned char *, const unsigned char *,
+                               const int *, unsigned char *,
+                               const unsigned char *, const int *,
+                               const ROTGRIDS *, const int);
+
+/* Shared by the tasks of binarize_image_V2().  Each task only writes */
+/* the binary image rows it was given.                                */
+typedef struct binimage{
+   unsigned char *bdata;
+   int bw, bh;
+   const unsigned char *spptr;  /* First unpadded pixel of the input */
+   int pw;
+   const int *direction_map;
+   int mw;
+   int blocksize;
+   const ROTGRIDS *dirbingrids;
+   int cy;                      /* Center row of the grids */
+   dirbin_runs_fn dirbin_runs;  /* Vector kernel, or NULL */
+} BINIMAGE;
+
+static pthread_once_t binar_once = PTHREAD_ONCE_INIT;
+static dirbin_runs_fn dirbin_runs_simd;
+static int binar_simd = 1;
+
+static void binar_init_once(void);
+static void binarize_rows(const BINIMAGE *, const int, const int);
+static void binarize_task(void *, const int);
+static int dirbin_center_row(const ROTGRIDS *);
+static int dirbin_pixel(const unsigned char *, const int *,
+                        const ROTGRIDS *, const int);
+
 /*************************************************************************
 **************************************************************************
 #cat: binarize_V2 - Takes a padded grayscale input image and its associated
@@ -131,9 +190,10 @@ int binarize_image_V2(unsigned char **odata, int *ow, int *oh,
                    const int *direction_map, const int mw, const int mh,
                    const int blocksize, const ROTGRIDS *dirbingrids)
 {
-   int ix, iy, bw, bh, bx, by, mapval;
-   unsigned char *bdata, *bptr;
-   unsigned char *pptr, *spptr;
+   int bw, bh;
+   unsigned char *bdata;
+   BINIMAGE bi;
+   LFS_RUNNER runner;
 
    /* Compute dimensions of "unpadded" binary image results. */
    bw = pw - (dirbingrids->pad<<1);
@@ -145,34 +205,33 @@ int binarize_image_V2(unsigned char **odata, int *ow, int *oh,
       return(-600);
    }
 
-   bptr = bdata;
-   spptr = pdata + (dirbingrids->pad * pw) + dirbingrids->pad;
-   for(iy = 0; iy < bh; iy++){
-      /* Set pixel pointer to start of next row in grid. */
-      pptr = spptr;
-      for(ix = 0; ix < bw; ix++){
-
-         /* Compute which block the current pixel is in. */
-         bx = (int)(ix/blocksize);
-         by = (int)(iy/blocksize);
-         /* Get corresponding value in Direction Map. */
-         mapval = *(direction_map + (by*mw) + bx);
-         /* If current block has has INVALID direction ... */
-         if(mapval == INVALID_DIR)
-            /* Set binary pixel to white (255). */
-            *bptr = WHITE_PIXEL;
-         /* Otherwise, if block has a valid direction ... */
-         else /*if(mapval >= 0)*/
-            /* Use directional binarization based on block's direction. */
-            *bptr = dirbinarize(pptr, mapval, dirbingrids);
-
-         /* Bump input and output pixel pointers. */
-         pptr++;
-         bptr++;
-      }
-      /* Bump pointer to the next row in padded input image. */
-      spptr += pw;
-   }
+   pthread_once(&binar_once, binar_init_once);
+
+   bi.bdata = bdata;
+   bi.bw = bw;
+   bi.bh = bh;
+   bi.spptr = pdata + (dirbingrids->pad * pw) + dirbingrids->pad;
+   bi.pw = pw;
+   bi.direction_map = direction_map;
+   bi.mw = mw;
+   bi.blocksize = blocksize;
+   bi.dirbingrids = dirbingrids;
+   bi.cy = dirbin_center_row(dirbingrids);
+
+   /* The vector kernel sums in 16-bit lanes, so it is only used where */
+   /* a whole grid of white pixels cannot overflow them.               */
+   bi.dirbin_runs = (dirbin_runs_fn)NULL;
+   if(binar_simd &&
+      (dirbingrids->grid_w * dirbingrids->grid_h * WHITE_PIXEL <= 32767))
+      bi.dirbin_runs = dirbin_runs_simd;
+
+   /* Every output pixel is independent of the others, so if a runner */
+   /* is installed, the rows are spread over it in groups.            */
+   runner = get_lfs_runner();
+   if((runner == (LFS_RUNNER)NULL) || (bh <= BINAR_TASK_ROWS))
+      binarize_rows(&bi, 0, bh);
+   else
+      runner(binarize_task, &bi, (bh + BINAR_TASK_ROWS - 1) / BINAR_TASK_ROWS);
 
    *odata = bdata;
    *ow = bw;
@@ -201,19 +260,67 @@ int binarize_image_V2(unsigned char **odata, int *ow, int *oh,
 int dirbinarize(const unsigned char *pptr, const int idir,
                 const ROTGRIDS *dirbingrids)
 {
-   int gx, gy, gi, cy;
-   int rsum, gsum, csum = 0;
-   int *grid;
+   return(dirbin_pixel(pptr, dirbingrids->grids[idir], dirbingrids,
+                       dirbin_center_row(dirbingrids)));
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: set_binar_simd - Enables or disables the use of vector kernels by
+#cat:             binarize_image_V2(), where the CPU supports them.  They
+#cat:             are enabled by default.  Disabling them allows their
+#cat:             results to be checked against the scalar routines.
+
+   Input:
+      enable - TRUE to use vector kernels, FALSE to use scalar code only
+**************************************************************************/
+void set_binar_simd(const int enable)
+{
+   binar_simd = enable;
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: dirbin_center_row - Returns the center (0-oriented) row of the
+#cat:             rotated directional binarization grids.
+
+   Input:
+      dirbingrids - set of precomputed rotated grid offsets
+   Return Code:
+      Row      - index of the center row
+**************************************************************************/
+static int dirbin_center_row(const ROTGRIDS *dirbingrids)
+{
    double dcy;
 
-   /* Assign nickname pointer. */
-   grid = dirbingrids->grids[idir];
    /* Calculate center (0-oriented) row in grid. */
    dcy = (dirbingrids->grid_h-1)/(double)2.0;
    /* Need to truncate precision so that answers are consistent */
    /* on different computer architectures when rounding doubles. */
    dcy = trunc_dbl_precision(dcy, TRUNC_SCALE);
-   cy = sround(dcy);
+   return(sround(dcy));
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: dirbin_pixel - Determines the binary value of a grayscale pixel
+#cat:             along a given rotated grid.  See dirbinarize().
+
+   Input:
+      pptr        - pointer to current grayscale pixel
+      grid        - rotated grid offsets of the pixel's direction
+      dirbingrids - set of precomputed rotated grid offsets
+      cy          - center row of the grids
+   Return Code:
+      BLACK_PIXEL - pixel intensity for BLACK
+      WHITE_PIXEL - pixel intensity of WHITE
+**************************************************************************/
+static int dirbin_pixel(const unsigned char *pptr, const int *grid,
+                        const ROTGRIDS *dirbingrids, const int cy)
+{
+   int gx, gy, gi;
+   int rsum, gsum, csum = 0;
+
    /* Initialize grid's pixel offset index to zero. */
    gi = 0;
    /* Initialize grid's pixel accumulator to zero */
@@ -247,3 +354,152 @@ int dirbinarize(const unsigned char *pptr, const int idir,
       return(WHITE_PIXEL);
 }
 
+#ifdef BINAR_X86
+/*************************************************************************
+**************************************************************************
+#cat: dirbin_runs_avx2 - Binarizes two runs of BINAR_RUN adjacent pixels
+#cat:             with AVX2, each run along a single direction.  Adjacent
+#cat:             pixels sample adjacent bytes at each grid position, so
+#cat:             every grid position is one load per run, and the sums
+#cat:             of all sixteen pixels are accumulated in 16-bit lanes.
+#cat:             The caller must make sure these cannot overflow.
+**************************************************************************/
+__attribute__((target("avx2")))
+static void dirbin_runs_avx2(unsigned char *bptr0,
+               const unsigned char *pptr0, const int *grid0,
+               unsigned char *bptr1, const unsigned char *pptr1,
+               const int *grid1, const ROTGRIDS *dirbingrids, const int cy)
+{
+   __m256i rsum, gsum, csum, pix, black, bin;
+   int gx, gy, gi;
+
+   gi = 0;
+   gsum = _mm256_setzero_si256();
+   csum = _mm256_setzero_si256();
+   for(gy = 0; gy < dirbingrids->grid_h; gy++){
+      rsum = _mm256_setzero_si256();
+      for(gx = 0; gx < dirbingrids->grid_w; gx++){
+         pix = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(
+                  _mm_loadl_epi64((const __m128i *)(pptr0 + grid0[gi])),
+                  _mm_loadl_epi64((const __m128i *)(pptr1 + grid1[gi]))));
+         rsum = _mm256_add_epi16(rsum, pix);
+         gi++;
+      }
+      gsum = _mm256_add_epi16(gsum, rsum);
+      if(gy == cy)
+         csum = rsum;
+   }
+
+   /* BLACK where the center row, as an average, is below the total. */
+   csum = _mm256_mullo_epi16(csum, _mm256_set1_epi16(dirbingrids->grid_h));
+   black = _mm256_cmpgt_epi16(gsum, csum);
+   bin = _mm256_blendv_epi8(_mm256_set1_epi16(WHITE_PIXEL),
+                            _mm256_set1_epi16(BLACK_PIXEL), black);
+   /* Packing works within 128-bit lanes, leaving each run in the low */
+   /* 8 bytes of its own lane.                                        */
+   bin = _mm256_packus_epi16(bin, bin);
+   _mm_storel_epi64((__m128i *)bptr0, _mm256_castsi256_si128(bin));
+   _mm_storel_epi64((__m128i *)bptr1, _mm256_extracti128_si256(bin, 1));
+}
+#endif
+
+/*************************************************************************/
+static void binar_init_once(void)
+{
+   dirbin_runs_simd = (dirbin_runs_fn)NULL;
+#ifdef BINAR_X86
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      dirbin_runs_simd = dirbin_runs_avx2;
+#endif
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: binarize_rows - Binarizes a range of rows of the image.  Rows are
+#cat:             processed block by block, so that runs of pixels
+#cat:             sharing a direction can go to the vector kernel, two
+#cat:             at a time.
+
+   Input:
+      bi        - binary image being generated and the data to generate
+                  it from
+      firstrow  - first row to binarize
+      lastrow   - row following the last one to binarize
+   Output:
+      bi        - the binary image's given rows
+**************************************************************************/
+static void binarize_rows(const BINIMAGE *bi, const int firstrow,
+                          const int lastrow)
+{
+   const ROTGRIDS *dirbingrids = bi->dirbingrids;
+   const int blocksize = bi->blocksize;
+   const unsigned char *pptr, *pend_pptr = (const unsigned char *)NULL;
+   unsigned char *bptr, *pend_bptr = (unsigned char *)NULL;
+   const int *mptr, *grid, *pend_grid = (const int *)NULL;
+   int ix, iy, xend, mapval;
+
+   for(iy = firstrow; iy < lastrow; iy++){
+      pptr = bi->spptr + (iy * bi->pw);
+      bptr = bi->bdata + (iy * bi->bw);
+      /* Direction Map row of the blocks the current row is in. */
+      mptr = bi->direction_map + ((int)(iy/blocksize) * bi->mw);
+
+      /* Foreach block along the row ... */
+      for(ix = 0; ix < bi->bw; ix = xend){
+         xend = min(ix + blocksize, bi->bw);
+         mapval = *(mptr + (int)(ix/blocksize));
+
+         /* If current block has has INVALID direction ... */
+         if(mapval == INVALID_DIR){
+            /* Set binary pixels to white (255). */
+            memset(bptr + ix, WHITE_PIXEL, xend - ix);
+            continue;
+         }
+
+         /* Otherwise, use directional binarization based on block's */
+         /* direction, pairing up whole runs for the vector kernel.   */
+         grid = dirbingrids->grids[mapval];
+         if(bi->dirbin_runs != (dirbin_runs_fn)NULL){
+            for(; ix + BINAR_RUN <= xend; ix += BINAR_RUN){
+               if(pend_bptr == (unsigned char *)NULL){
+                  pend_bptr = bptr + ix;
+                  pend_pptr = pptr + ix;
+                  pend_grid = grid;
+               }
+               else{
+                  bi->dirbin_runs(pend_bptr, pend_pptr, pend_grid,
+                                  bptr + ix, pptr + ix, grid,
+                                  dirbingrids, bi->cy);
+                  pend_bptr = (unsigned char *)NULL;
+               }
+            }
+         }
+         for(; ix < xend; ix++)
+            *(bptr + ix) = dirbin_pixel(pptr + ix, grid, dirbingrids, bi->cy);
+      }
+   }
+
+   /* A run left without a partner is simply binarized twice. */
+   if(pend_bptr != (unsigned char *)NULL)
+      bi->dirbin_runs(pend_bptr, pend_pptr, pend_grid,
+                      pend_bptr, pend_pptr, pend_grid, dirbingrids, bi->cy);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: binarize_task - LFS_TASK binarizing the rows of one of the tasks
+#cat:             of binarize_image_V2().
+
+   Input:
+      arg       - the BINIMAGE being generated
+      task      - index of the task
+**************************************************************************/
+static void binarize_task(void *arg, const int task)
+{
+   const BINIMAGE *bi = (const BINIMAGE *)arg;
+   int firstrow;
+
+   firstrow = task * BINAR_TASK_ROWS;
+   binarize_rows(bi, firstrow, min(firstrow + BINAR_TASK_ROWS, bi->bh));
+}
@@ -60,6 +60,8 @@ identified are necessarily the best available for the purpose.
       iw        - width (in pixels) of the image
       ih        - height (in pixels) of the image
       lfsparms  - parameters and thresholds for controlling LFS
+      tables    - lookup tables built by init_lfs_tables() for the
+                  image dimensions and lfsparms
 
    Output:
       ominutiae - resulting list of minutiae
@@ -86,14 +88,10 @@ static int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
                         int *omw, int *omh,
                         unsigned char **obdata, int *obw, int *obh,
                         unsigned char *idata, const int iw, const int ih,
-                        const LFSPARMS *lfsparms)
+                        const LFSPARMS *lfsparms, const LFSTABLES *tables)
 {
    unsigned char *pdata, *bdata;
    int pw, ph, bw, bh;
-   DIR2RAD *dir2rad;
-   DFTWAVES *dftwaves;
-   ROTGRIDS *dftgrids;
-   ROTGRIDS *dirbingrids;
    int *direction_map, *low_contrast_map, *low_flow_map, *high_curve_map;
    int mw, mh;
    int ret, maxpad;
@@ -108,47 +106,20 @@ static int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
       /* If system error, exit with error code. */
       return(ret);
 
-   /* Determine the maximum amount of image padding required to support */
-   /* LFS processes.                                                    */
-   maxpad = get_max_padding_V2(lfsparms->windowsize, lfsparms->windowoffset,
-                          lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h);
-
-   /* Initialize lookup table for converting integer directions */
-   /* to angles in radians.                                     */
-   if((ret = init_dir2rad(&dir2rad, lfsparms->num_directions))){
-      /* Free memory allocated to this point. */
-      return(ret);
-   }
-
-   /* Initialize wave form lookup tables for DFT analyses. */
-   /* used for direction binarization.                             */
-   if((ret = init_dftwaves(&dftwaves, dft_coefs, lfsparms->num_dft_waves,
-                        lfsparms->windowsize))){
-      /* Free memory allocated to this point. */
-      free_dir2rad(dir2rad);
-      return(ret);
-   }
-
-   /* Initialize lookup table for pixel offsets to rotated grids */
-   /* used for DFT analyses.                                     */
-   if((ret = init_rotgrids(&dftgrids, iw, ih, maxpad,
-                        lfsparms->start_dir_angle, lfsparms->num_directions,
-                        lfsparms->windowsize, lfsparms->windowsize,
-                        RELATIVE2ORIGIN))){
-      /* Free memory allocated to this point. */
-      free_dir2rad(dir2rad);
-      free_dftwaves(dftwaves);
-      return(ret);
+   /* The lookup tables were built for these dimensions and parameters */
+   /* by init_lfs_tables().                                            */
+   if((tables->iw != iw) || (tables->ih != ih) ||
+      (tables->lfsparms != lfsparms)){
+      fprintf(stderr, "ERROR : lfs_detect_minutiae_V2 : ");
+      fprintf(stderr, "tables do not fit image : %d, %d\n", iw, ih);
+      return(-582);
    }
+   maxpad = tables->maxpad;
 
    /* Pad input image based on max padding. */
    if(maxpad > 0){   /* May not need to pad at all */
       if((ret = pad_uchar_image(&pdata, &pw, &ph, idata, iw, ih,
                              maxpad, lfsparms->pad_value))){
-         /* Free memory allocated to this point. */
-         free_dir2rad(dir2rad);
-         free_dftwaves(dftwaves);
-         free_rotgrids(dftgrids);
          return(ret);
       }
    }
@@ -156,10 +127,6 @@ static int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
       /* If padding is unnecessary, then copy the input image. */
       pdata = (unsigned char *)malloc(iw*ih);
       if(pdata == (unsigned char *)NULL){
-         /* Free memory allocated to this point. */
-         free_dir2rad(dir2rad);
-         free_dftwaves(dftwaves);
-         free_rotgrids(dftgrids);
          fprintf(stderr, "ERROR : lfs_detect_minutiae_V2 : malloc : pdata\n");
          return(-580);
       }
@@ -185,18 +152,12 @@ static int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
    /* Generate block maps from the input image. */
    if((ret = gen_image_maps(&direction_map, &low_contrast_map,
                     &low_flow_map, &high_curve_map, &mw, &mh,
-                    pdata, pw, ph, dir2rad, dftwaves, dftgrids, lfsparms))){
+                    pdata, pw, ph, tables->dir2rad, tables->dftwaves,
+                    tables->dftgrids, lfsparms))){
       /* Free memory allocated to this point. */
-      free_dir2rad(dir2rad);
-      free_dftwaves(dftwaves);
-      free_rotgrids(dftgrids);
       free(pdata);
       return(ret);
    }
-   /* Deallocate working memories. */
-   free_dir2rad(dir2rad);
-   free_dftwaves(dftwaves);
-   free_rotgrids(dftgrids);
 
    print2log("\nMAPS DONE\n");
 
@@ -204,38 +165,19 @@ static int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
    /* BINARIZARION   */
    /******************/
 
-   /* Initialize lookup table for pixel offsets to rotated grids */
-   /* used for directional binarization.                         */
-   if((ret = init_rotgrids(&dirbingrids, iw, ih, maxpad,
-                        lfsparms->start_dir_angle, lfsparms->num_directions,
-                        lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h,
-                        RELATIVE2CENTER))){
-      /* Free memory allocated to this point. */
-      free(pdata);
-      free(direction_map);
-      free(low_contrast_map);
-      free(low_flow_map);
-      free(high_curve_map);
-      return(ret);
-   }
-
    /* Binarize input image based on NMAP information. */
    if((ret = binarize_V2(&bdata, &bw, &bh,
                       pdata, pw, ph, direction_map, mw, mh,
-                      dirbingrids, lfsparms))){
+                      tables->dirbingrids, lfsparms))){
       /* Free memory allocated to this point. */
       free(pdata);
       free(direction_map);
       free(low_contrast_map);
       free(low_flow_map);
       free(high_curve_map);
-      free_rotgrids(dirbingrids);
       return(ret);
    }
 
-   /* Deallocate working memory. */
-   free_rotgrids(dirbingrids);
-
    /* Check dimension of binary image.  If they are different from */
    /* the input image, then ERROR.                                 */
    if((iw != bw) || (ih != bh)){
@@ -358,6 +300,9 @@ static int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
       id       - pixel depth (in bits) of the grayscale image
       ppmm     - the scan resolution (in pixels/mm) of the grayscale image
       lfsparms - parameters and thresholds for controlling LFS
+      tables   - lookup tables built by init_lfs_tables() for the image
+                 dimensions and lfsparms, or NULL to have them built
+                 (and freed again) for this one image
    Output:
       ominutiae         - points to a structure containing the
                           detected minutiae
@@ -382,9 +327,11 @@ int get_minutiae(MINUTIAE **ominutiae, int **oquality_map,
                  int *omap_w, int *omap_h,
                  unsigned char **obdata, int *obw, int *obh, int *obd,
                  unsigned char *idata, const int iw, const int ih,
-                 const int id, const double ppmm, const LFSPARMS *lfsparms)
+                 const int id, const double ppmm, const LFSPARMS *lfsparms,
+                 const LFSTABLES *tables)
 {
    int ret;
+   LFSTABLES *own_tables = (LFSTABLES *)NULL;
    MINUTIAE *minutiae;
    int *direction_map, *low_contrast_map, *low_flow_map;
    int *high_curve_map, *quality_map;
@@ -399,13 +346,23 @@ int get_minutiae(MINUTIAE **ominutiae, int **oquality_map,
       return(-2);
    }
 
+   /* Build lookup tables if none were passed in. */
+   if(tables == (LFSTABLES *)NULL){
+      if((ret = init_lfs_tables(&own_tables, iw, ih, lfsparms)))
+         return(ret);
+      tables = own_tables;
+   }
+
    /* Detect minutiae in grayscale fingerpeint image. */
-   if((ret = lfs_detect_minutiae_V2(&minutiae,
+   ret = lfs_detect_minutiae_V2(&minutiae,
                                    &direction_map, &low_contrast_map,
                                    &low_flow_map, &high_curve_map,
                                    &map_w, &map_h,
                                    &bdata, &bw, &bh,
-                                   idata, iw, ih, lfsparms))){
+                                   idata, iw, ih, lfsparms, tables);
+   if(own_tables != (LFSTABLES *)NULL)
+      free_lfs_tables(own_tables);
+   if(ret){
       return(ret);
    }
 
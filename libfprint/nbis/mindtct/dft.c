@@ -33,9 +33,16 @@ identified are necessarily the best available for the purpose.
       Transforms (DFT) analysis on a block of image data as part of
       the NIST Latent Fingerprint System (LFS).
 
+      Where the CPU supports AVX2, the DFT powers are computed by a
+      vector kernel which gathers eight pixels at a time, and applies
+      each wave form to four directions at once.  It sums in the same
+      order and at the same precision as the scalar routines, so the
+      resulting powers are identical.
+
 ***********************************************************************
                ROUTINES:
                         dft_dir_powers()
+                        set_dft_simd()
                         sum_rot_block_rows()
                         dft_power()
                         dft_power_stats()
@@ -43,10 +50,25 @@ identified are necessarily the best available for the purpose.
                         sort_dft_waves()
 ***********************************************************************/
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <lfs.h>
 
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define DFT_X86
+#include <immintrin.h>
+#endif
+
+/* Computes the DFT powers of the block at blkptr in every direction, */
+/* using rowsums (ngrids X grid_w ints) as working memory.            */
+typedef void (*dir_powers_fn)(double **, const unsigned char *, int *,
+                              const DFTWAVES *, const ROTGRIDS *);
+
+static pthread_once_t dft_once = PTHREAD_ONCE_INIT;
+static dir_powers_fn dir_powers_simd;
+static int dft_simd = 1;
+
 /*************************************************************************
 **************************************************************************
 #cat: sum_rot_block_rows - Computes a vector or pixel row sums by sampling
@@ -125,6 +147,143 @@ static void dft_power(double *power, const int *rowsums,
    *power = (cospart * cospart) + (sinpart * sinpart);
 }
 
+/*************************************************************************
+**************************************************************************
+#cat: dir_powers_scalar - Computes the DFT powers of an image block one
+#cat:             direction and one wave form at a time.
+**************************************************************************/
+static void dir_powers_scalar(double **powers, const unsigned char *blkptr,
+               int *rowsums, const DFTWAVES *dftwaves,
+               const ROTGRIDS *dftgrids)
+{
+   int w, dir;
+
+   /* Foreach direction ... */
+   for(dir = 0; dir < dftgrids->ngrids; dir++){
+      /* Compute vector of line sums from rotated grid */
+      sum_rot_block_rows(rowsums, blkptr,
+                         dftgrids->grids[dir], dftgrids->grid_w);
+
+      /* Foreach DFT wave ... */
+      for(w = 0; w < dftwaves->nwaves; w++){
+         dft_power(&(powers[w][dir]), rowsums,
+                   dftwaves->waves[w], dftwaves->wavelen);
+      }
+   }
+}
+
+#ifdef DFT_X86
+/*************************************************************************
+**************************************************************************
+#cat: dir_powers_avx2 - Computes the DFT powers of an image block with
+#cat:             AVX2.  Pixels are gathered as 32-bit words and masked
+#cat:             down to their first byte, so up to 3 bytes beyond the
+#cat:             last grid position must be readable.  Row sums are
+#cat:             stored direction-minor, so that each wave form can be
+#cat:             applied to four directions at once.  The caller must
+#cat:             make sure the wave length matches the grid size.
+**************************************************************************/
+__attribute__((target("avx2")))
+static void dir_powers_avx2(double **powers, const unsigned char *blkptr,
+               int *rowsums, const DFTWAVES *dftwaves,
+               const ROTGRIDS *dftgrids)
+{
+   const int n = dftgrids->grid_w;
+   const int ndirs = dftgrids->ngrids;
+   const __m256i bytemask = _mm256_set1_epi32(0xff);
+   const int *grid;
+   const DFTWAVE *wave;
+   __m256i acc, idx, pix;
+   __m128i sum4;
+   __m256d rs, cospart, sinpart;
+   double cs, sn;
+   int w, dir, ix, iy, i, sum;
+
+   /* Foreach direction ... */
+   for(dir = 0; dir < ndirs; dir++){
+      grid = dftgrids->grids[dir];
+      /* Sum each rotated row, 8 pixels at a time. */
+      for(iy = 0; iy < n; iy++){
+         acc = _mm256_setzero_si256();
+         for(ix = 0; ix + 8 <= n; ix += 8){
+            idx = _mm256_loadu_si256((const __m256i *)(grid + ix));
+            pix = _mm256_i32gather_epi32((const int *)blkptr, idx, 1);
+            acc = _mm256_add_epi32(acc, _mm256_and_si256(pix, bytemask));
+         }
+         sum4 = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                              _mm256_extracti128_si256(acc, 1));
+         sum4 = _mm_add_epi32(sum4,
+                              _mm_shuffle_epi32(sum4, _MM_SHUFFLE(1,0,3,2)));
+         sum4 = _mm_add_epi32(sum4,
+                              _mm_shuffle_epi32(sum4, _MM_SHUFFLE(2,3,0,1)));
+         sum = _mm_cvtsi128_si32(sum4);
+         for(; ix < n; ix++)
+            sum += *(blkptr + grid[ix]);
+         rowsums[(iy * ndirs) + dir] = sum;
+         grid += n;
+      }
+   }
+
+   /* Foreach DFT wave ... */
+   for(w = 0; w < dftwaves->nwaves; w++){
+      wave = dftwaves->waves[w];
+      /* Accumulate cos and sin components for 4 directions at once, */
+      /* in the same order dft_power() does.                         */
+      for(dir = 0; dir + 4 <= ndirs; dir += 4){
+         cospart = _mm256_setzero_pd();
+         sinpart = _mm256_setzero_pd();
+         for(i = 0; i < n; i++){
+            rs = _mm256_cvtepi32_pd(_mm_loadu_si128(
+                      (const __m128i *)&rowsums[(i * ndirs) + dir]));
+            cospart = _mm256_add_pd(cospart,
+                      _mm256_mul_pd(rs, _mm256_set1_pd(wave->cos[i])));
+            sinpart = _mm256_add_pd(sinpart,
+                      _mm256_mul_pd(rs, _mm256_set1_pd(wave->sin[i])));
+         }
+         _mm256_storeu_pd(&(powers[w][dir]),
+                          _mm256_add_pd(_mm256_mul_pd(cospart, cospart),
+                                        _mm256_mul_pd(sinpart, sinpart)));
+      }
+      /* Remaining directions one at a time. */
+      for(; dir < ndirs; dir++){
+         cs = 0.0;
+         sn = 0.0;
+         for(i = 0; i < n; i++){
+            cs += (rowsums[(i * ndirs) + dir] * wave->cos[i]);
+            sn += (rowsums[(i * ndirs) + dir] * wave->sin[i]);
+         }
+         powers[w][dir] = (cs * cs) + (sn * sn);
+      }
+   }
+}
+#endif
+
+/*************************************************************************/
+static void dft_init_once(void)
+{
+   dir_powers_simd = (dir_powers_fn)NULL;
+#ifdef DFT_X86
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      dir_powers_simd = dir_powers_avx2;
+#endif
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: set_dft_simd - Enables or disables the use of vector kernels by
+#cat:             dft_dir_powers(), where the CPU supports them.  They
+#cat:             are enabled by default.  Disabling them allows their
+#cat:             results to be checked against the scalar routines.
+
+   Input:
+      enable - TRUE to use vector kernels, FALSE to use scalar code only
+**************************************************************************/
+void set_dft_simd(const int enable)
+{
+   dft_simd = enable;
+}
+
 /*************************************************************************
 **************************************************************************
 #cat: dft_dir_powers - Conducts the DFT analysis on a block of image data.
@@ -161,35 +320,35 @@ int dft_dir_powers(double **powers, unsigned char *pdata,
                const int blkoffset, const int pw, const int ph,
                const DFTWAVES *dftwaves, const ROTGRIDS *dftgrids)
 {
-   int w, dir;
    int *rowsums;
    unsigned char *blkptr;
+   dir_powers_fn dir_powers;
 
-   /* Allocate line sum vector, and initialize to zeros */
+   /* Allocate line sum vectors for all directions. */
    /* This routine requires square block (grid), so ERROR otherwise. */
    if(dftgrids->grid_w != dftgrids->grid_h){
       fprintf(stderr, "ERROR : dft_dir_powers : DFT grids must be square\n");
       return(-90);
    }
-   rowsums = (int *)malloc(dftgrids->grid_w * sizeof(int));
+   rowsums = (int *)malloc(dftgrids->ngrids * dftgrids->grid_w * sizeof(int));
    if(rowsums == (int *)NULL){
       fprintf(stderr, "ERROR : dft_dir_powers : malloc : rowsums\n");
       return(-91);
    }
 
-   /* Foreach direction ... */
-   for(dir = 0; dir < dftgrids->ngrids; dir++){
-      /* Compute vector of line sums from rotated grid */
-      blkptr = pdata + blkoffset;
-      sum_rot_block_rows(rowsums, blkptr,
-                         dftgrids->grids[dir], dftgrids->grid_w);
+   pthread_once(&dft_once, dft_init_once);
 
-      /* Foreach DFT wave ... */
-      for(w = 0; w < dftwaves->nwaves; w++){
-         dft_power(&(powers[w][dir]), rowsums,
-                   dftwaves->waves[w], dftwaves->wavelen);
-      }
-   }
+   /* The vector kernel may read a few bytes past the last pixel it */
+   /* samples, so blocks at the very end of the image are left to   */
+   /* the scalar code.                                              */
+   blkptr = pdata + blkoffset;
+   dir_powers = dir_powers_scalar;
+   if(dft_simd && (dir_powers_simd != (dir_powers_fn)NULL) &&
+      (dftwaves->wavelen == dftgrids->grid_w) &&
+      (blkoffset + dftgrids->max_offset + 3 < pw * ph))
+      dir_powers = dir_powers_simd;
+
+   dir_powers(powers, blkptr, rowsums, dftwaves, dftgrids);
 
    /* Deallocate working memory. */
    free(rowsums);
@@ -36,6 +36,7 @@ identified are necessarily the best available for the purpose.
                         free_dir2rad()
                         free_dftwaves()
                         free_rotgrids()
+                        free_lfs_tables()
                         free_dir_powers()
 ***********************************************************************/
 
@@ -96,6 +97,23 @@ void free_rotgrids(ROTGRIDS *rotgrids)
    free(rotgrids);
 }
 
+/*************************************************************************
+**************************************************************************
+#cat: free_lfs_tables - Deallocates the memory associated with a LFSTABLES
+#cat:                 structure
+
+   Input:
+      tables - pointer to memory to be freed
+**************************************************************************/
+void free_lfs_tables(LFSTABLES *tables)
+{
+   free_dir2rad(tables->dir2rad);
+   free_dftwaves(tables->dftwaves);
+   free_rotgrids(tables->dftgrids);
+   free_rotgrids(tables->dirbingrids);
+   free(tables);
+}
+
 /*************************************************************************
 **************************************************************************
 #cat: free_dir_powers - Deallocate memory associated with DFT power vectors
@@ -39,6 +39,7 @@ identified are necessarily the best available for the purpose.
                         init_dftwaves()
                         get_max_padding_V2()
                         init_rotgrids()
+                        init_lfs_tables()
                         alloc_dir_powers()
                         alloc_power_stats()
 ***********************************************************************/
@@ -399,6 +400,7 @@ int init_rotgrids(ROTGRIDS **optr, const int iw, const int ih, const int ipad,
    rotgrids->grid_h = grid_h;
    rotgrids->start_angle = start_dir_angle;
    rotgrids->relative2 = relative2;
+   rotgrids->max_offset = 0;
 
    /* Compute pad based on diagonal of the grid */
    diag = sqrt((double)((grid_w*grid_w)+(grid_h*grid_h)));
@@ -556,7 +558,11 @@ int init_rotgrids(ROTGRIDS **optr, const int iw, const int ih, const int ipad,
              /* rotated offset.  Make sure to       */
              /* multiply the y-component of the     */
              /* offset by the "padded" image width! */
-             *grid++ = ixt + (iyt * pw);
+             *grid = ixt + (iyt * pw);
+             if(((dir == 0) && (iy == 0) && (ix == 0)) ||
+                (*grid > rotgrids->max_offset))
+                rotgrids->max_offset = *grid;
+             grid++;
          }/* ix */
       }/* iy */
    }/* dir */
@@ -565,6 +571,95 @@ int init_rotgrids(ROTGRIDS **optr, const int iw, const int ih, const int ipad,
    return(0);
 }
 
+/*************************************************************************
+**************************************************************************
+#cat: init_lfs_tables - Allocates and initializes all the lookup tables
+#cat:           LFS needs to process images of specified dimensions: the
+#cat:           integer direction to radian conversions, the DFT wave
+#cat:           forms, and the rotated grid offsets for both the DFT
+#cat:           analyses and directional binarization.  None of them
+#cat:           depend on the image contents, so they may be reused for
+#cat:           every image of the same dimensions.
+
+   Input:
+      iw       - width (in pixels) of the images to be processed
+      ih       - height (in pixels) of the images to be processed
+      lfsparms - parameters and thresholds for controlling LFS
+   Output:
+      otables  - points to the allocated/initialized LFSTABLES structure
+   Return Code:
+      Zero     - successful completion
+      Negative - system error
+**************************************************************************/
+int init_lfs_tables(LFSTABLES **otables, const int iw, const int ih,
+                    const LFSPARMS *lfsparms)
+{
+   LFSTABLES *tables;
+   int ret;
+
+   tables = (LFSTABLES *)malloc(sizeof(LFSTABLES));
+   if(tables == (LFSTABLES *)NULL){
+      fprintf(stderr, "ERROR : init_lfs_tables : malloc : tables\n");
+      return(-60);
+   }
+   tables->iw = iw;
+   tables->ih = ih;
+   tables->lfsparms = lfsparms;
+
+   /* Determine the maximum amount of image padding required to support */
+   /* LFS processes.                                                    */
+   tables->maxpad = get_max_padding_V2(lfsparms->windowsize,
+                          lfsparms->windowoffset,
+                          lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h);
+
+   /* Initialize lookup table for converting integer directions */
+   /* to angles in radians.                                     */
+   if((ret = init_dir2rad(&(tables->dir2rad), lfsparms->num_directions))){
+      /* Free memory allocated to this point. */
+      free(tables);
+      return(ret);
+   }
+
+   /* Initialize wave form lookup tables for DFT analyses. */
+   if((ret = init_dftwaves(&(tables->dftwaves), dft_coefs,
+                        lfsparms->num_dft_waves, lfsparms->windowsize))){
+      /* Free memory allocated to this point. */
+      free_dir2rad(tables->dir2rad);
+      free(tables);
+      return(ret);
+   }
+
+   /* Initialize lookup table for pixel offsets to rotated grids */
+   /* used for DFT analyses.                                     */
+   if((ret = init_rotgrids(&(tables->dftgrids), iw, ih, tables->maxpad,
+                        lfsparms->start_dir_angle, lfsparms->num_directions,
+                        lfsparms->windowsize, lfsparms->windowsize,
+                        RELATIVE2ORIGIN))){
+      /* Free memory allocated to this point. */
+      free_dir2rad(tables->dir2rad);
+      free_dftwaves(tables->dftwaves);
+      free(tables);
+      return(ret);
+   }
+
+   /* Initialize lookup table for pixel offsets to rotated grids */
+   /* used for directional binarization.                         */
+   if((ret = init_rotgrids(&(tables->dirbingrids), iw, ih, tables->maxpad,
+                        lfsparms->start_dir_angle, lfsparms->num_directions,
+                        lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h,
+                        RELATIVE2CENTER))){
+      /* Free memory allocated to this point. */
+      free_dir2rad(tables->dir2rad);
+      free_dftwaves(tables->dftwaves);
+      free_rotgrids(tables->dftgrids);
+      free(tables);
+      return(ret);
+   }
+
+   *otables = tables;
+   return(0);
+}
+
 /*************************************************************************
 **************************************************************************
 #cat: alloc_dir_powers - Allocates the memory associated with DFT power
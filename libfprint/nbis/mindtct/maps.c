@@ -41,6 +41,8 @@ identified are necessarily the best available for the purpose.
                ROUTINES:
                         gen_image_maps()
                         gen_initial_maps()
+                        initial_maps_rows()
+                        initial_maps_task()
                         interpolate_direction_map()
                         morph_TF_map()
                         pixelize_map()
@@ -141,6 +143,10 @@ int gen_image_maps(int **odmap, int **olcmap, int **olfmap, int **ohcmap,
       return(ret);
    }
 
+   /* Steps 3 to 7 update the Direction Map in place from each block's */
+   /* neighbors, so their results depend on the order blocks are       */
+   /* visited in.  Unlike step 2, they are always done sequentially.   */
+
    /* 3. Remove directions that are inconsistent with neighbors */
    remove_incon_dirs(direction_map, mw, mh, dir2rad, lfsparms);
 
@@ -186,51 +192,51 @@ int gen_image_maps(int **odmap, int **olcmap, int **olfmap, int **ohcmap,
    return(0);
 }
 
+/* Number of block rows in each of the tasks gen_initial_maps() hands */
+/* to the LFS runner.                                                 */
+#define MAP_TASK_ROWS   2
+
+/* Shared by the tasks of gen_initial_maps().  Each task only writes */
+/* the map entries of the block rows it was given.                   */
+typedef struct initmaps{
+   int *direction_map;
+   int *low_contrast_map;
+   int *low_flow_map;
+   int *blkoffs;
+   int mw, mh;
+   unsigned char *pdata;
+   int pw, ph;
+   const DFTWAVES *dftwaves;
+   const ROTGRIDS *dftgrids;
+   const LFSPARMS *lfsparms;
+   int *rets;           /* Return code of each task */
+} INITMAPS;
+
 /*************************************************************************
 **************************************************************************
-#cat: gen_initial_maps - Creates an initial Direction Map from the given
-#cat:             input image.  It very important that the image be properly
-#cat:             padded so that rotated grids along the boundary of the image
-#cat:             do not access unkown memory.  The rotated grids are used by a
-#cat:             DFT-based analysis to determine the integer directions
-#cat:             in the map. Typically this initial vector of directions will
-#cat:             subsequently have weak or inconsistent directions removed
-#cat:             followed by a smoothing process.  The resulting Direction
-#cat:             Map contains valid directions >= 0 and INVALID values = -1.
-#cat:             This routine also computes and returns 2 other image maps.
-#cat:             The Low Contrast Map flags blocks in the image with
-#cat:             insufficient contrast.  Blocks with low contrast have a
-#cat:             corresponding direction of INVALID in the Direction Map.
-#cat:             The Low Flow Map flags blocks in which the DFT analyses
-#cat:             could not determine a significant ridge flow.  Blocks with
-#cat:             low ridge flow also have a corresponding direction of
-#cat:             INVALID in the Direction Map.
+#cat: initial_maps_rows - Computes the initial Direction, Low Contrast,
+#cat:             and Low Flow Map entries of a range of block rows.
+#cat:             Blocks are analyzed independently of each other, so
+#cat:             separate ranges may be processed concurrently.
 
    Input:
-      blkoffs   - offsets to the pixel origin of each block in the padded image
-      mw        - number of blocks horizontally in the padded input image
-      mh        - number of blocks vertically in the padded input image
-      pdata     - padded input image data (8 bits [0..256) grayscale)
-      pw        - width (in pixels) of the padded input image
-      ph        - height (in pixels) of the padded input image
-      dftwaves  - structure containing the DFT wave forms
-      dftgrids  - structure containing the rotated pixel grid offsets
-      lfsparms  - parameters and thresholds for controlling LFS
+      im        - maps being generated and the data to generate them from
+      firstrow  - first block row to process
+      lastrow   - block row following the last one to process
    Output:
-      odmap     - points to the newly created Direction Map
-      olcmap    - points to the newly created Low Contrast Map
+      im        - the maps' entries for the given rows
    Return Code:
       Zero     - successful completion
       Negative - system error
 **************************************************************************/
-int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
-                int *blkoffs, const int mw, const int mh,
-                unsigned char *pdata, const int pw, const int ph,
-                const DFTWAVES *dftwaves, const  ROTGRIDS *dftgrids,
-                const LFSPARMS *lfsparms)
+static int initial_maps_rows(const INITMAPS *im, const int firstrow,
+                const int lastrow)
 {
-   int *direction_map, *low_contrast_map, *low_flow_map;
-   int bi, bsize, blkdir;
+   const DFTWAVES *dftwaves = im->dftwaves;
+   const ROTGRIDS *dftgrids = im->dftgrids;
+   const LFSPARMS *lfsparms = im->lfsparms;
+   const int mw = im->mw, pw = im->pw;
+   int bi, blkdir;
    int *wis, *powmax_dirs;
    double **powers, *powmaxs, *pownorms;
    int nstats;
@@ -239,52 +245,9 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
    int xminlimit, xmaxlimit, yminlimit, ymaxlimit;
    int win_x, win_y, low_contrast_offset;
 
-   print2log("INITIAL MAP\n");
-
-   /* Compute total number of blocks in map */
-   bsize = mw * mh;
-
-   /* Allocate Direction Map memory */
-   direction_map = (int *)malloc(bsize * sizeof(int));
-   if(direction_map == (int *)NULL){
-      fprintf(stderr,
-              "ERROR : gen_initial_maps : malloc : direction_map\n");
-      return(-550);
-   }
-   /* Initialize the Direction Map to INVALID (-1). */
-   memset(direction_map, INVALID_DIR, bsize * sizeof(int));
-
-   /* Allocate Low Contrast Map memory */
-   low_contrast_map = (int *)malloc(bsize * sizeof(int));
-   if(low_contrast_map == (int *)NULL){
-      free(direction_map);
-      fprintf(stderr,
-              "ERROR : gen_initial_maps : malloc : low_contrast_map\n");
-      return(-551);
-   }
-   /* Initialize the Low Contrast Map to FALSE (0). */
-   memset(low_contrast_map, 0, bsize * sizeof(int));
-
-   /* Allocate Low Ridge Flow Map memory */
-   low_flow_map = (int *)malloc(bsize * sizeof(int));
-   if(low_flow_map == (int *)NULL){
-      free(direction_map);
-      free(low_contrast_map);
-      fprintf(stderr,
-              "ERROR : gen_initial_maps : malloc : low_flow_map\n");
-      return(-552);
-   }
-   /* Initialize the Low Flow Map to FALSE (0). */
-   memset(low_flow_map, 0, bsize * sizeof(int));
-
    /* Allocate DFT directional power vectors */
-   if((ret = alloc_dir_powers(&powers, dftwaves->nwaves, dftgrids->ngrids))){
-      /* Free memory allocated to this point. */
-      free(direction_map);
-      free(low_contrast_map);
-      free(low_flow_map);
+   if((ret = alloc_dir_powers(&powers, dftwaves->nwaves, dftgrids->ngrids)))
       return(ret);
-   }
 
    /* Allocate DFT power statistic arrays */
    /* Compute length of statistics arrays.  Statistics not needed   */
@@ -292,10 +255,6 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
    nstats = dftwaves->nwaves - 1;
    if((ret = alloc_power_stats(&wis, &powmaxs, &powmax_dirs,
                             &pownorms, nstats))){
-      /* Free memory allocated to this point. */
-      free(direction_map);
-      free(low_contrast_map);
-      free(low_flow_map);
       free_dir_powers(powers, dftwaves->nwaves);
       return(ret);
    }
@@ -305,13 +264,13 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
    xminlimit = dftgrids->pad;
    yminlimit = dftgrids->pad;
    xmaxlimit = pw - dftgrids->pad - lfsparms->windowsize - 1;
-   ymaxlimit = ph - dftgrids->pad - lfsparms->windowsize - 1;
+   ymaxlimit = im->ph - dftgrids->pad - lfsparms->windowsize - 1;
 
-   /* Foreach block in image ... */
-   for(bi = 0; bi < bsize; bi++){
+   /* Foreach block in the given rows ... */
+   for(bi = firstrow * mw; bi < lastrow * mw; bi++){
       /* Adjust block offset from pointing to block origin to pointing */
       /* to surrounding window origin.                                 */
-      dft_offset = blkoffs[bi] - (lfsparms->windowoffset * pw) -
+      dft_offset = im->blkoffs[bi] - (lfsparms->windowoffset * pw) -
                       lfsparms->windowoffset;
 
       /* Compute pixel coords of window origin. */
@@ -330,23 +289,15 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
 
       /* If block is low contrast ... */
       if((ret = low_contrast_block(low_contrast_offset, lfsparms->windowsize,
-                                  pdata, pw, ph, lfsparms))){
+                                  im->pdata, pw, im->ph, lfsparms))){
          /* If system error ... */
-         if(ret < 0){
-            free(direction_map);
-            free(low_contrast_map);
-            free(low_flow_map);
-            free_dir_powers(powers, dftwaves->nwaves);
-            free(wis);
-            free(powmaxs);
-            free(powmax_dirs);
-            free(pownorms);
-            return(ret);
-         }
+         if(ret < 0)
+            break;
 
          /* Otherwise, block is low contrast ... */
          print2log("LOW CONTRAST\n");
-         low_contrast_map[bi] = TRUE;
+         im->low_contrast_map[bi] = TRUE;
+         ret = 0;
          /* Direction Map's block is already set to INVALID. */
       }
       /* Otherwise, sufficient contrast for DFT processing ... */
@@ -354,36 +305,16 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
          print2log("\n");
 
          /* Compute DFT powers */
-         if((ret = dft_dir_powers(powers, pdata, low_contrast_offset, pw, ph,
-                               dftwaves, dftgrids))){
-            /* Free memory allocated to this point. */
-            free(direction_map);
-            free(low_contrast_map);
-            free(low_flow_map);
-            free_dir_powers(powers, dftwaves->nwaves);
-            free(wis);
-            free(powmaxs);
-            free(powmax_dirs);
-            free(pownorms);
-            return(ret);
-         }
+         if((ret = dft_dir_powers(powers, im->pdata, low_contrast_offset,
+                               pw, im->ph, dftwaves, dftgrids)))
+            break;
 
          /* Compute DFT power statistics, skipping first applied DFT  */
          /* wave.  This is dependent on how the primary and secondary */
          /* direction tests work below.                               */
          if((ret = dft_power_stats(wis, powmaxs, powmax_dirs, pownorms, powers,
-                                1, dftwaves->nwaves, dftgrids->ngrids))){
-            /* Free memory allocated to this point. */
-            free(direction_map);
-            free(low_contrast_map);
-            free(low_flow_map);
-            free_dir_powers(powers, dftwaves->nwaves);
-            free(wis);
-            free(powmaxs);
-            free(powmax_dirs);
-            free(pownorms);
-            return(ret);
-         }
+                                1, dftwaves->nwaves, dftgrids->ngrids)))
+            break;
 
 #ifdef LOG_REPORT /*vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv*/
          {  int _w;
@@ -403,17 +334,17 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
                                   pownorms, nstats, lfsparms);
 
          if(blkdir != INVALID_DIR)
-            direction_map[bi] = blkdir;
+            im->direction_map[bi] = blkdir;
          else{
             /* Conduct secondary (fork) direction test */
             blkdir = secondary_fork_test(powers, wis, powmaxs, powmax_dirs,
                                   pownorms, nstats, lfsparms);
             if(blkdir != INVALID_DIR)
-               direction_map[bi] = blkdir;
+               im->direction_map[bi] = blkdir;
             /* Otherwise current direction in Direction Map remains INVALID */
             else
                /* Flag the block as having LOW RIDGE FLOW. */
-               low_flow_map[bi] = TRUE;
+               im->low_flow_map[bi] = TRUE;
          }
 
       } /* End DFT */
@@ -426,6 +357,168 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
    free(powmax_dirs);
    free(pownorms);
 
+   return(ret);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: initial_maps_task - LFS_TASK processing the block rows of one of the
+#cat:             tasks of gen_initial_maps(), and recording its result.
+
+   Input:
+      arg       - the INITMAPS being generated
+      task      - index of the task
+**************************************************************************/
+static void initial_maps_task(void *arg, const int task)
+{
+   INITMAPS *im = (INITMAPS *)arg;
+   int firstrow, lastrow;
+
+   firstrow = task * MAP_TASK_ROWS;
+   lastrow = min(firstrow + MAP_TASK_ROWS, im->mh);
+   im->rets[task] = initial_maps_rows(im, firstrow, lastrow);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: gen_initial_maps - Creates an initial Direction Map from the given
+#cat:             input image.  It very important that the image be properly
+#cat:             padded so that rotated grids along the boundary of the image
+#cat:             do not access unkown memory.  The rotated grids are used by a
+#cat:             DFT-based analysis to determine the integer directions
+#cat:             in the map. Typically this initial vector of directions will
+#cat:             subsequently have weak or inconsistent directions removed
+#cat:             followed by a smoothing process.  The resulting Direction
+#cat:             Map contains valid directions >= 0 and INVALID values = -1.
+#cat:             This routine also computes and returns 2 other image maps.
+#cat:             The Low Contrast Map flags blocks in the image with
+#cat:             insufficient contrast.  Blocks with low contrast have a
+#cat:             corresponding direction of INVALID in the Direction Map.
+#cat:             The Low Flow Map flags blocks in which the DFT analyses
+#cat:             could not determine a significant ridge flow.  Blocks with
+#cat:             low ridge flow also have a corresponding direction of
+#cat:             INVALID in the Direction Map.
+
+   Input:
+      blkoffs   - offsets to the pixel origin of each block in the padded image
+      mw        - number of blocks horizontally in the padded input image
+      mh        - number of blocks vertically in the padded input image
+      pdata     - padded input image data (8 bits [0..256) grayscale)
+      pw        - width (in pixels) of the padded input image
+      ph        - height (in pixels) of the padded input image
+      dftwaves  - structure containing the DFT wave forms
+      dftgrids  - structure containing the rotated pixel grid offsets
+      lfsparms  - parameters and thresholds for controlling LFS
+   Output:
+      odmap     - points to the newly created Direction Map
+      olcmap    - points to the newly created Low Contrast Map
+   Return Code:
+      Zero     - successful completion
+      Negative - system error
+**************************************************************************/
+int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
+                int *blkoffs, const int mw, const int mh,
+                unsigned char *pdata, const int pw, const int ph,
+                const DFTWAVES *dftwaves, const  ROTGRIDS *dftgrids,
+                const LFSPARMS *lfsparms)
+{
+   int *direction_map, *low_contrast_map, *low_flow_map;
+   int bsize;
+   INITMAPS im;
+   LFS_RUNNER runner;
+   int i, ntasks;
+   int ret; /* return code */
+
+   print2log("INITIAL MAP\n");
+
+   /* Compute total number of blocks in map */
+   bsize = mw * mh;
+
+   /* Allocate Direction Map memory */
+   direction_map = (int *)malloc(bsize * sizeof(int));
+   if(direction_map == (int *)NULL){
+      fprintf(stderr,
+              "ERROR : gen_initial_maps : malloc : direction_map\n");
+      return(-550);
+   }
+   /* Initialize the Direction Map to INVALID (-1). */
+   memset(direction_map, INVALID_DIR, bsize * sizeof(int));
+
+   /* Allocate Low Contrast Map memory */
+   low_contrast_map = (int *)malloc(bsize * sizeof(int));
+   if(low_contrast_map == (int *)NULL){
+      free(direction_map);
+      fprintf(stderr,
+              "ERROR : gen_initial_maps : malloc : low_contrast_map\n");
+      return(-551);
+   }
+   /* Initialize the Low Contrast Map to FALSE (0). */
+   memset(low_contrast_map, 0, bsize * sizeof(int));
+
+   /* Allocate Low Ridge Flow Map memory */
+   low_flow_map = (int *)malloc(bsize * sizeof(int));
+   if(low_flow_map == (int *)NULL){
+      free(direction_map);
+      free(low_contrast_map);
+      fprintf(stderr,
+              "ERROR : gen_initial_maps : malloc : low_flow_map\n");
+      return(-552);
+   }
+   /* Initialize the Low Flow Map to FALSE (0). */
+   memset(low_flow_map, 0, bsize * sizeof(int));
+
+   /* The blocks are analyzed independently of each other, so if a     */
+   /* runner is installed, the rows are spread over it in small groups. */
+   im.direction_map = direction_map;
+   im.low_contrast_map = low_contrast_map;
+   im.low_flow_map = low_flow_map;
+   im.blkoffs = blkoffs;
+   im.mw = mw;
+   im.mh = mh;
+   im.pdata = pdata;
+   im.pw = pw;
+   im.ph = ph;
+   im.dftwaves = dftwaves;
+   im.dftgrids = dftgrids;
+   im.lfsparms = lfsparms;
+   im.rets = (int *)NULL;
+
+   runner = get_lfs_runner();
+#ifdef LOG_REPORT
+   /* Keep the log in block order. */
+   runner = (LFS_RUNNER)NULL;
+#endif
+
+   if((runner == (LFS_RUNNER)NULL) || (mh <= MAP_TASK_ROWS))
+      ret = initial_maps_rows(&im, 0, mh);
+   else{
+      ntasks = (mh + MAP_TASK_ROWS - 1) / MAP_TASK_ROWS;
+      im.rets = (int *)malloc(ntasks * sizeof(int));
+      if(im.rets == (int *)NULL){
+         free(direction_map);
+         free(low_contrast_map);
+         free(low_flow_map);
+         fprintf(stderr,
+                 "ERROR : gen_initial_maps : malloc : rets\n");
+         return(-553);
+      }
+      runner(initial_maps_task, &im, ntasks);
+
+      /* Report the first error in block order, as sequentially. */
+      ret = 0;
+      for(i = 0; (i < ntasks) && (ret == 0); i++)
+         ret = im.rets[i];
+      free(im.rets);
+   }
+
+   if(ret){
+      /* Free memory allocated to this point. */
+      free(direction_map);
+      free(low_contrast_map);
+      free(low_flow_map);
+      return(ret);
+   }
+
    *odmap = direction_map;
    *olcmap = low_contrast_map;
    *olfmap = low_flow_map;
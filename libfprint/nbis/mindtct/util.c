@@ -44,12 +44,16 @@ identified are necessarily the best available for the purpose.
                         angle2line()
                         line2direction()
                         closest_dir_dist()
+                        set_lfs_runner()
+                        get_lfs_runner()
 ***********************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <lfs.h>
 
+static LFS_RUNNER lfs_runner = (LFS_RUNNER)NULL;
+
 /*************************************************************************
 **************************************************************************
 #cat: maxv - Determines the maximum value in the given list of integers.
@@ -603,3 +607,31 @@ int closest_dir_dist(const int dir1, const int dir2, const int ndirs)
    return(dist);
 }
 
+/*************************************************************************
+**************************************************************************
+#cat: set_lfs_runner - Installs a runner through which LFS may process
+#cat:             independent parts of an image on several threads at
+#cat:             once.  With no runner, which is the default, all the
+#cat:             work is done in sequence on the calling thread.  The
+#cat:             results are the same either way.
+
+   Input:
+      runner - the runner to use, or NULL to work sequentially
+**************************************************************************/
+void set_lfs_runner(LFS_RUNNER runner)
+{
+   lfs_runner = runner;
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: get_lfs_runner - Returns the runner installed by set_lfs_runner().
+
+   Return Code:
+      Runner   - the runner to use for independent tasks
+      NULL     - work is to be done sequentially
+**************************************************************************/
+LFS_RUNNER get_lfs_runner(void)
+{
+   return(lfs_runner);
+}
@@ -21,9 +21,23 @@
 
 #include <config.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <sys/time.h>
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#define USE_EVENT_FD
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+
 #include <glib.h>
 #include <libusb.h>
 
@@ -34,13 +48,13 @@
  * These functions are only applicable to users of libfprint's asynchronous
  * API.
  *
- * libfprint does not create internal library threads and hence can only
- * execute when your application is calling a libfprint function. However,
- * libfprint often has work to be do, such as handling of completed USB
- * transfers, and processing of timeouts required in order for the library
- * to function. Therefore it is essential that your own application must
- * regularly "phone into" libfprint so that libfprint can handle any pending
- * events.
+ * libfprint only calls back into your application when your application is
+ * calling a libfprint function. Image processing and matching run on
+ * internal worker threads, but their results are only acted upon from within
+ * the event handling functions below, like handling of completed USB
+ * transfers and processing of timeouts. Therefore it is essential that your
+ * own application must regularly "phone into" libfprint so that libfprint
+ * can handle any pending events.
  *
  * The function you must call is fp_handle_events() or a variant of it. This
  * function will handle any pending events, and it is from this context that
@@ -53,13 +67,23 @@
  * fp_handle_events_timeout() instead. If you wish to do a nonblocking
  * iteration, call fp_handle_events_timeout() with a zero timeout.
  *
+ * Applications with a main loop of their own can instead watch the single
+ * file descriptor returned by fp_get_event_fd(), and call
+ * fp_dispatch_events() whenever it becomes readable.
+ *
  * TODO: document how application is supposed to know when to call these
  * functions.
  */
 
-/* this is a singly-linked list of pending timers, sorted with the timer that
- * is expiring soonest at the head. */
-static GSList *active_timers = NULL;
+/* this is a binary min-heap of pending timers, with the timer that is
+ * expiring soonest at the root. each timer knows its position in the heap, so
+ * that adding and cancelling take logarithmic time. timers expiring at the
+ * same time are ordered by when they were added. */
+static GPtrArray *active_timers = NULL;
+static guint64 timer_seq = 0;
+
+#define TIMER_AT(i) \
+	((struct fpi_timeout *) g_ptr_array_index(active_timers, (i)))
 
 /* notifiers for added or removed poll fds */
 static fp_pollfd_added_cb fd_added_cb = NULL;
@@ -67,23 +91,111 @@ static fp_pollfd_removed_cb fd_removed_cb = NULL;
 
 struct fpi_timeout {
 	struct timeval expiry;
+	guint64 seq;
+	guint heap_index;
+	fpi_timeout_fn callback;
+	void *data;
+};
+
+/* callbacks deferred from other threads to the event loop, most recent
+ * first, and the read and write ends through which those threads wake the
+ * loop up: both the same eventfd, or else a pipe */
+G_LOCK_DEFINE_STATIC(deferred);
+static GSList *deferred = NULL;
+static int wakeup_fd[2] = { -1, -1 };
+
+/* the file descriptors the event loop waits on: the wakeup fd and those of
+ * libusb, kept up to date through its notifiers */
+static GArray *poll_fds = NULL;
+
+#ifdef USE_EVENT_FD
+/* the single event fd, once the application has asked for it: an epoll
+ * instance watching the fds above, plus a timerfd armed for the next
+ * timeout */
+static int epoll_fd = -1;
+static int timer_fd = -1;
+
+static void arm_timer(void);
+#endif
+
+struct fpi_deferred {
 	fpi_timeout_fn callback;
 	void *data;
 };
 
-static int timeout_sort_fn(gconstpointer _a, gconstpointer _b)
+static gboolean timeout_before(struct fpi_timeout *a, struct fpi_timeout *b)
 {
-	struct fpi_timeout *a = (struct fpi_timeout *) _a;
-	struct fpi_timeout *b = (struct fpi_timeout *) _b;
 	struct timeval *tv_a = &a->expiry;
 	struct timeval *tv_b = &b->expiry;
 
 	if (timercmp(tv_a, tv_b, <))
-		return -1;
+		return TRUE;
 	else if (timercmp(tv_a, tv_b, >))
-		return 1;
+		return FALSE;
 	else
-		return 0;
+		return a->seq < b->seq;
+}
+
+static void timer_heap_set(guint i, struct fpi_timeout *timeout)
+{
+	g_ptr_array_index(active_timers, i) = timeout;
+	timeout->heap_index = i;
+}
+
+/* move the timer at position i towards the root until its parent expires
+ * first */
+static void timer_heap_up(guint i)
+{
+	struct fpi_timeout *timeout = TIMER_AT(i);
+
+	while (i > 0) {
+		guint parent = (i - 1) / 2;
+		if (!timeout_before(timeout, TIMER_AT(parent)))
+			break;
+		timer_heap_set(i, TIMER_AT(parent));
+		i = parent;
+	}
+	timer_heap_set(i, timeout);
+}
+
+/* move the timer at position i towards the leaves until both its children
+ * expire after it */
+static void timer_heap_down(guint i)
+{
+	struct fpi_timeout *timeout = TIMER_AT(i);
+	guint len = active_timers->len;
+
+	for (;;) {
+		guint child = 2 * i + 1;
+		if (child >= len)
+			break;
+		if (child + 1 < len
+				&& timeout_before(TIMER_AT(child + 1), TIMER_AT(child)))
+			child++;
+		if (!timeout_before(TIMER_AT(child), timeout))
+			break;
+		timer_heap_set(i, TIMER_AT(child));
+		i = child;
+	}
+	timer_heap_set(i, timeout);
+}
+
+static void timer_heap_remove(struct fpi_timeout *timeout)
+{
+	guint i = timeout->heap_index;
+	struct fpi_timeout *last;
+
+	/* fill the hole with the last timer, then restore the ordering
+	 * around it */
+	last = g_ptr_array_remove_index(active_timers, active_timers->len - 1);
+	if (last == timeout)
+		return;
+
+	timer_heap_set(i, last);
+	if (i > 0 && timeout_before(last, TIMER_AT((i - 1) / 2)))
+		timer_heap_up(i);
+	else
+		timer_heap_down(i);
 }
 
 /* A timeout is the asynchronous equivalent of sleeping. You create a timeout
@@ -106,6 +218,7 @@ struct fpi_timeout *fpi_timeout_add(unsigned int msec, fpi_timeout_fn callback,
 	}
 
 	timeout = g_malloc(sizeof(*timeout));
+	timeout->seq = timer_seq++;
 	timeout->callback = callback;
 	timeout->data = data;
 	TIMESPEC_TO_TIMEVAL(&timeout->expiry, &ts);
@@ -116,8 +229,12 @@ struct fpi_timeout *fpi_timeout_add(unsigned int msec, fpi_timeout_fn callback,
 	add_msec.tv_usec = (msec % 1000) * 1000;
 	timeradd(&timeout->expiry, &add_msec, &timeout->expiry);
 
-	active_timers = g_slist_insert_sorted(active_timers, timeout,
-		timeout_sort_fn);
+	g_ptr_array_add(active_timers, timeout);
+	timer_heap_up(active_timers->len - 1);
+#ifdef USE_EVENT_FD
+	if (timer_fd >= 0 && timeout->heap_index == 0)
+		arm_timer();
+#endif
 
 	return timeout;
 }
@@ -125,10 +242,89 @@ struct fpi_timeout *fpi_timeout_add(unsigned int msec, fpi_timeout_fn callback,
 void fpi_timeout_cancel(struct fpi_timeout *timeout)
 {
 	fp_dbg("");
-	active_timers = g_slist_remove(active_timers, timeout);
+	timer_heap_remove(timeout);
 	g_free(timeout);
 }
 
+/* Arranges for a callback to be invoked from within the event loop, as soon
+ * as it next runs. Unlike the other functions here, this one may be called
+ * from any thread: it is how work done away from the event loop reports
+ * back to it. */
+void fpi_poll_defer(fpi_timeout_fn callback, void *data)
+{
+	struct fpi_deferred *d = g_malloc(sizeof(*d));
+	guint64 one = 1;
+
+	d->callback = callback;
+	d->data = data;
+
+	G_LOCK(deferred);
+	deferred = g_slist_prepend(deferred, d);
+	G_UNLOCK(deferred);
+
+	/* if it cannot take any more, a wakeup is pending anyway */
+	if (wakeup_fd[1] >= 0 && write(wakeup_fd[1], &one, sizeof(one)) < 0
+			&& errno != EAGAIN)
+		fp_err("failed to wake event loop, errno=%d", errno);
+}
+
+/* run the deferred callbacks, in the order they were deferred. returns
+ * whether there were any. */
+static gboolean handle_deferred(void)
+{
+	GSList *list;
+	GSList *elem;
+	char buf[64];
+
+	/* drain the wakeup fd before taking the list, so that a callback
+	 * deferred in between still leaves it readable */
+	if (wakeup_fd[0] >= 0)
+		while (read(wakeup_fd[0], buf, sizeof(buf)) > 0)
+			;
+
+	G_LOCK(deferred);
+	list = deferred;
+	deferred = NULL;
+	G_UNLOCK(deferred);
+
+	if (!list)
+		return FALSE;
+
+	list = g_slist_reverse(list);
+	for (elem = list; elem; elem = g_slist_next(elem)) {
+		struct fpi_deferred *d = elem->data;
+		d->callback(d->data);
+		g_free(d);
+	}
+	g_slist_free(list);
+	return TRUE;
+}
+
+static gboolean have_deferred(void)
+{
+	gboolean r;
+
+	G_LOCK(deferred);
+	r = deferred != NULL;
+	G_UNLOCK(deferred);
+	return r;
+}
+
+/* wait for activity on the USB file descriptors or the wakeup fd, for at
+ * most the given time */
+static int wait_for_events(struct timeval *timeout)
+{
+	int r;
+
+	r = poll((struct pollfd *) poll_fds->data, poll_fds->len,
+		timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000);
+	if (r < 0 && errno != EINTR) {
+		fp_err("poll failed, errno=%d", errno);
+		return -errno;
+	}
+	return 0;
+}
+
 /* get the expiry time and optionally the timeout structure for the next
  * timeout. returns 0 if there are no expired timers, or 1 if the
  * timeval/timeout output parameters were populated. if the returned timeval
@@ -142,7 +338,7 @@ static int get_next_timeout_expiry(struct timeval *out,
 	struct fpi_timeout *next_timeout;
 	int r;
 
-	if (active_timers == NULL)
+	if (active_timers->len == 0)
 		return 0;
 
 	r = clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -152,7 +348,7 @@ static int get_next_timeout_expiry(struct timeval *out,
 	}
 	TIMESPEC_TO_TIMEVAL(&tv, &ts);
 
-	next_timeout = active_timers->data;
+	next_timeout = TIMER_AT(0);
 	if (out_timeout)
 		*out_timeout = next_timeout;
 
@@ -172,22 +368,36 @@ static void handle_timeout(struct fpi_timeout *timeout)
 {
 	fp_dbg("");
 	timeout->callback(timeout->data);
-	active_timers = g_slist_remove(active_timers, timeout);
+	timer_heap_remove(timeout);
 	g_free(timeout);
 }
 
+/* handle every timeout which had expired on entry. those expiring later,
+ * including any added by the callbacks, wait for the next iteration, so
+ * that a device rescheduling itself cannot hold up the others. */
 static int handle_timeouts(void)
 {
-	struct timeval next_timeout_expiry;
-	struct fpi_timeout *next_timeout;
+	struct timespec ts;
+	struct timeval now;
+	struct fpi_timeout *timeout;
 	int r;
 
-	r = get_next_timeout_expiry(&next_timeout_expiry, &next_timeout);
-	if (r <= 0)
+	if (active_timers->len == 0)
+		return 0;
+
+	r = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (r < 0) {
+		fp_err("failed to read monotonic clock, errno=%d", errno);
 		return r;
+	}
+	TIMESPEC_TO_TIMEVAL(&now, &ts);
 
-	if (!timerisset(&next_timeout_expiry))
-		handle_timeout(next_timeout);
+	while (active_timers->len) {
+		timeout = TIMER_AT(0);
+		if (!timercmp(&timeout->expiry, &now, <))
+			break;
+		handle_timeout(timeout);
+	}
 
 	return 0;
 }
@@ -198,6 +408,11 @@ static int handle_timeouts(void)
  * return sooner if events have been handled. The function acts as non-blocking
  * for a zero timeout.
  *
+ * Each call handles everything which is ready at the time for all devices:
+ * completed USB transfers, expired timeouts and results of image processing.
+ * A device with a lot of activity thus cannot hold up the others, and one
+ * event loop can serve many devices.
+ *
  * \param timeout Maximum timeout for this blocking function
  * \returns 0 on success, non-zero on error.
  */
@@ -205,6 +420,9 @@ API_EXPORTED int fp_handle_events_timeout(struct timeval *timeout)
 {
 	struct timeval next_timeout_expiry;
 	struct timeval select_timeout;
+	struct timeval poll_timeout;
+	struct timeval usb_timeout;
+	struct timeval zero_timeout = { 0, 0 };
 	struct fpi_timeout *next_timeout;
 	int r;
 
@@ -212,28 +430,39 @@ API_EXPORTED int fp_handle_events_timeout(struct timeval *timeout)
 	if (r < 0)
 		return r;
 
-	if (r) {
-		/* timer already expired? */
-		if (!timerisset(&next_timeout_expiry)) {
-			handle_timeout(next_timeout);
-			return 0;
-		}
-
-		/* choose the smallest of next URB timeout or user specified timeout */
-		if (timercmp(&next_timeout_expiry, timeout, <))
-			select_timeout = next_timeout_expiry;
-		else
-			select_timeout = *timeout;
-	} else {
+	/* choose the smallest of next URB timeout or user specified timeout */
+	if (r && timercmp(&next_timeout_expiry, timeout, <))
+		select_timeout = next_timeout_expiry;
+	else
 		select_timeout = *timeout;
-	}
 
-	r = libusb_handle_events_timeout(fpi_usb_ctx, &select_timeout);
+	/* we wait for events ourselves, so that the wakeup fd is watched
+	 * along with the USB file descriptors, then let libusb handle
+	 * whatever is ready, including its own timeouts. if a timer has
+	 * expired or results are waiting, we only look at what is ready. */
+	poll_timeout = select_timeout;
+	if (have_deferred())
+		timerclear(&poll_timeout);
+	else if (libusb_get_next_timeout(fpi_usb_ctx, &usb_timeout) == 1
+			&& timercmp(&usb_timeout, &poll_timeout, <))
+		poll_timeout = usb_timeout;
+
+	r = wait_for_events(&poll_timeout);
+	if (r < 0)
+		return r;
+
+	r = libusb_handle_events_timeout(fpi_usb_ctx, &zero_timeout);
 	*timeout = select_timeout;
 	if (r < 0)
 		return r;
 
-	return handle_timeouts();
+	handle_deferred();
+	r = handle_timeouts();
+#ifdef USE_EVENT_FD
+	if (timer_fd >= 0)
+		arm_timer();
+#endif
+	return r;
 }
 
 /** \ingroup poll
@@ -262,6 +491,12 @@ API_EXPORTED int fp_get_next_timeout(struct timeval *tv)
 	int r_fprint;
 	int r_libusb;
 
+	/* deferred callbacks are waiting to be run */
+	if (have_deferred()) {
+		timerclear(tv);
+		return 1;
+	}
+
 	r_fprint = get_next_timeout_expiry(&fprint_timeout, NULL);
 	r_libusb = libusb_get_next_timeout(fpi_usb_ctx, &libusb_timeout);
 
@@ -291,31 +526,187 @@ API_EXPORTED int fp_get_next_timeout(struct timeval *tv)
  */
 API_EXPORTED size_t fp_get_pollfds(struct fp_pollfd **pollfds)
 {
-	const struct libusb_pollfd **usbfds;
-	const struct libusb_pollfd *usbfd;
 	struct fp_pollfd *ret;
-	size_t cnt = 0;
-	size_t i = 0;
+	size_t i;
+
+	/* the USB file descriptors and the wakeup fd, as last notified */
+	ret = g_malloc(sizeof(struct fp_pollfd) * MAX(poll_fds->len, 1));
+	for (i = 0; i < poll_fds->len; i++) {
+		struct pollfd *pfd = &g_array_index(poll_fds, struct pollfd, i);
+		ret[i].fd = pfd->fd;
+		ret[i].events = pfd->events;
+	}
 
-	usbfds = libusb_get_pollfds(fpi_usb_ctx);
-	if (!usbfds) {
-		*pollfds = NULL;
-		return -EIO;
+	*pollfds = ret;
+	return poll_fds->len;
+}
+
+#ifdef USE_EVENT_FD
+
+static void epoll_watch(int fd, short events)
+{
+	struct epoll_event ev;
+
+	ev.events = (events & POLLIN ? EPOLLIN : 0)
+		| (events & POLLOUT ? EPOLLOUT : 0);
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		fp_err("failed to watch fd %d, errno=%d", fd, errno);
+}
+
+/* arm the timerfd for whichever comes first of our next timeout and that of
+ * libusb, or disarm it if there are none. this also makes it unreadable
+ * until then. */
+static void arm_timer(void)
+{
+	struct itimerspec its;
+	struct timeval expiry;
+	struct timeval usb_timeout;
+	struct timespec ts;
+	int have_expiry = 0;
+
+	if (active_timers->len) {
+		expiry = TIMER_AT(0)->expiry;
+		have_expiry = 1;
 	}
 
-	while ((usbfd = usbfds[i++]) != NULL)
-		cnt++;
+	/* libusb only gives its timeouts relative to now */
+	if (libusb_get_next_timeout(fpi_usb_ctx, &usb_timeout) == 1
+			&& clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		struct timeval tv;
 
-	ret = g_malloc(sizeof(struct fp_pollfd) * cnt);
-	i = 0;
-	while ((usbfd = usbfds[i]) != NULL) {
-		ret[i].fd = usbfd->fd;
-		ret[i].events = usbfd->events;
-		i++;
+		TIMESPEC_TO_TIMEVAL(&tv, &ts);
+		timeradd(&tv, &usb_timeout, &tv);
+		if (!have_expiry || timercmp(&tv, &expiry, <))
+			expiry = tv;
+		have_expiry = 1;
 	}
 
-	*pollfds = ret;
-	return cnt;
+	memset(&its, 0, sizeof(its));
+	if (have_expiry) {
+		TIMEVAL_TO_TIMESPEC(&expiry, &its.it_value);
+		/* a zero time would disarm the timer */
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+			its.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		fp_err("failed to arm timer, errno=%d", errno);
+}
+
+#endif
+
+/** \ingroup poll
+ * Retrieve a single file descriptor which becomes readable whenever
+ * libfprint has events to handle: USB activity, expired timeouts and
+ * results of image processing. This is an alternative to fp_get_pollfds()
+ * and the pollfd notifiers, for applications which run their own main
+ * loop: add the descriptor to it once, and call fp_dispatch_events() when
+ * it is readable. The set of descriptors behind it is kept up to date by
+ * libfprint. The descriptor is an epoll instance, so it can also be added
+ * to another epoll set.
+ *
+ * The descriptor belongs to libfprint and stays valid until fp_exit(). Do
+ * not read from it or close it.
+ *
+ * \returns the file descriptor, or negative on error. -ENOSYS means that
+ * the platform does not support it.
+ */
+API_EXPORTED int fp_get_event_fd(void)
+{
+#ifdef USE_EVENT_FD
+	guint i;
+	int r;
+
+	if (epoll_fd >= 0)
+		return epoll_fd;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		r = -errno;
+		fp_err("failed to create epoll instance, errno=%d", errno);
+		return r;
+	}
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		r = -errno;
+		fp_err("failed to create timer, errno=%d", errno);
+		close(epoll_fd);
+		epoll_fd = -1;
+		return r;
+	}
+
+	epoll_watch(timer_fd, POLLIN);
+	for (i = 0; i < poll_fds->len; i++) {
+		struct pollfd *pfd = &g_array_index(poll_fds, struct pollfd, i);
+		epoll_watch(pfd->fd, pfd->events);
+	}
+	arm_timer();
+	return epoll_fd;
+#else
+	return -ENOSYS;
+#endif
+}
+
+/** \ingroup poll
+ * Handle the events which are pending, without blocking. This is meant to be
+ * called when the descriptor from fp_get_event_fd() is readable; it is then
+ * cheaper than fp_handle_events_timeout(), since only the kind of events
+ * reported ready are looked at. Without that descriptor, it behaves as
+ * fp_handle_events_timeout() with a zero timeout.
+ *
+ * \returns 0 on success, non-zero on error.
+ */
+API_EXPORTED int fp_dispatch_events(void)
+{
+	struct timeval zero_timeout = { 0, 0 };
+#ifdef USE_EVENT_FD
+	struct epoll_event events[16];
+	gboolean usb_ready = FALSE;
+	gboolean timer_ready = FALSE;
+	gboolean wakeup_ready = FALSE;
+	int n, i;
+	int r = 0;
+
+	if (epoll_fd < 0)
+		return fp_handle_events_timeout(&zero_timeout);
+
+	/* descriptors left over are still ready next time round. only the
+	 * kinds which are ready matter here, libusb looks at all of its own. */
+	n = epoll_wait(epoll_fd, events, G_N_ELEMENTS(events), 0);
+	if (n < 0) {
+		if (errno != EINTR) {
+			fp_err("epoll_wait failed, errno=%d", errno);
+			return -errno;
+		}
+		n = 0;
+	}
+	for (i = 0; i < n; i++) {
+		if (events[i].data.fd == timer_fd)
+			timer_ready = TRUE;
+		else if (events[i].data.fd == wakeup_fd[0])
+			wakeup_ready = TRUE;
+		else
+			usb_ready = TRUE;
+	}
+
+	/* the timer also stands for libusb's own timeouts */
+	if (usb_ready || timer_ready) {
+		r = libusb_handle_events_timeout(fpi_usb_ctx, &zero_timeout);
+		if (r < 0)
+			return r;
+	}
+	if (wakeup_ready || have_deferred())
+		handle_deferred();
+	if (timer_ready)
+		r = handle_timeouts();
+
+	/* transfers and timeouts may have come and gone meanwhile */
+	arm_timer();
+	return r;
+#else
+	return fp_handle_events_timeout(&zero_timeout);
+#endif
 }
 
 /* FIXME: docs */
@@ -326,26 +717,105 @@ API_EXPORTED void fp_set_pollfd_notifiers(fp_pollfd_added_cb added_cb,
 	fd_removed_cb = removed_cb;
 }
 
+static void watch_fd(int fd, short events)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	g_array_append_val(poll_fds, pfd);
+}
+
 static void add_pollfd(int fd, short events, void *user_data)
 {
+	watch_fd(fd, events);
+#ifdef USE_EVENT_FD
+	if (epoll_fd >= 0)
+		epoll_watch(fd, events);
+#endif
 	if (fd_added_cb)
 		fd_added_cb(fd, events);
 }
 
 static void remove_pollfd(int fd, void *user_data)
 {
+	guint i;
+
+	for (i = 0; i < poll_fds->len; i++)
+		if (g_array_index(poll_fds, struct pollfd, i).fd == fd) {
+			g_array_remove_index_fast(poll_fds, i);
+			break;
+		}
+#ifdef USE_EVENT_FD
+	/* the fd may be closed already, which removed it from the set */
+	if (epoll_fd >= 0)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+
 	if (fd_removed_cb)
 		fd_removed_cb(fd);
 }
 
 void fpi_poll_init(void)
 {
+	const struct libusb_pollfd **usbfds;
+	int i;
+
+	active_timers = g_ptr_array_new();
+	poll_fds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+
+	/* without a wakeup fd, deferred callbacks still run, only not before
+	 * the event loop next wakes up for another reason */
+#ifdef HAVE_SYS_EVENTFD_H
+	wakeup_fd[0] = wakeup_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeup_fd[0] >= 0)
+		watch_fd(wakeup_fd[0], POLLIN);
+	else
+#endif
+	if (pipe(wakeup_fd) < 0) {
+		fp_err("failed to create wakeup pipe, errno=%d", errno);
+		wakeup_fd[0] = wakeup_fd[1] = -1;
+	} else {
+		for (i = 0; i < 2; i++) {
+			fcntl(wakeup_fd[i], F_SETFL,
+				fcntl(wakeup_fd[i], F_GETFL) | O_NONBLOCK);
+			fcntl(wakeup_fd[i], F_SETFD, FD_CLOEXEC);
+		}
+		watch_fd(wakeup_fd[0], POLLIN);
+	}
+
 	libusb_set_pollfd_notifiers(fpi_usb_ctx, add_pollfd, remove_pollfd, NULL);
+	usbfds = libusb_get_pollfds(fpi_usb_ctx);
+	if (usbfds) {
+		for (i = 0; usbfds[i]; i++)
+			watch_fd(usbfds[i]->fd, usbfds[i]->events);
+		free(usbfds);
+	}
 }
 
 void fpi_poll_exit(void)
 {
-	g_slist_free(active_timers);
+	/* whatever is still deferred may own resources, so let it finish */
+	handle_deferred();
+	if (wakeup_fd[0] >= 0) {
+		close(wakeup_fd[0]);
+		if (wakeup_fd[1] != wakeup_fd[0])
+			close(wakeup_fd[1]);
+		wakeup_fd[0] = wakeup_fd[1] = -1;
+	}
+#ifdef USE_EVENT_FD
+	if (epoll_fd >= 0) {
+		close(timer_fd);
+		close(epoll_fd);
+		timer_fd = epoll_fd = -1;
+	}
+#endif
+	g_array_free(poll_fds, TRUE);
+	poll_fds = NULL;
+
+	g_ptr_array_foreach(active_timers, (GFunc) g_free, NULL);
+	g_ptr_array_free(active_timers, TRUE);
 	active_timers = NULL;
 	fd_added_cb = NULL;
 	fd_removed_cb = NULL;
@@ -21,6 +21,7 @@
 
 #include <config.h>
 #include <errno.h>
+#include <string.h>
 
 #include "fp_internal.h"
 
@@ -417,6 +418,82 @@ static void identify_stop_cb(struct fp_dev *dev, void *user_data)
 	*stopped = TRUE;
 }
 
+/* Identifies against print_gallery, or if idx is set, against its candidates,
+ * or if gallery is set, against that gallery object */
+static int sync_identify(struct fp_dev *dev,
+	struct fp_print_data **print_gallery, struct fp_print_index *idx,
+	struct fp_gallery *gallery, size_t *match_offset, struct fp_img **img)
+{
+	struct fp_driver *drv = dev->drv;
+	gboolean stopped = FALSE;
+	struct sync_identify_data *idata
+		= g_malloc0(sizeof(struct sync_identify_data));
+	int r;
+
+	fp_dbg("to be handled by %s", drv->name);
+
+	if (idx)
+		r = fp_async_identify_indexed_start(dev, idx, sync_identify_cb,
+			idata);
+	else if (gallery)
+		r = fp_async_identify_gallery_start(dev, gallery, sync_identify_cb,
+			idata);
+	else
+		r = fp_async_identify_start(dev, print_gallery, sync_identify_cb,
+			idata);
+	if (r < 0) {
+		fp_err("identify_start error %d", r);
+		goto err;
+	}
+
+	while (!idata->populated) {
+		r = fp_handle_events();
+		if (r < 0)
+			goto err_stop;
+	}
+
+	if (img)
+		*img = idata->img;
+	else
+		fp_img_free(idata->img);
+
+	r = idata->result;
+	switch (idata->result) {
+	case FP_VERIFY_NO_MATCH:
+		fp_dbg("result: no match");
+		break;
+	case FP_VERIFY_MATCH:
+		fp_dbg("result: match at offset %zd", idata->match_offset);
+		*match_offset = idata->match_offset;
+		break;
+	case FP_VERIFY_RETRY:
+		fp_dbg("verify should retry");
+		break;
+	case FP_VERIFY_RETRY_TOO_SHORT:
+		fp_dbg("swipe was too short, verify should retry");
+		break;
+	case FP_VERIFY_RETRY_CENTER_FINGER:
+		fp_dbg("finger was not centered, verify should retry");
+		break;
+	case FP_VERIFY_RETRY_REMOVE_FINGER:
+		fp_dbg("scan failed, remove finger and retry");
+		break;
+	default:
+		fp_err("unrecognised return code %d", r);
+		r = -EINVAL;
+	}
+
+err_stop:
+	if (fp_async_identify_stop(dev, identify_stop_cb, &stopped) == 0)
+		while (!stopped)
+			if (fp_handle_events() < 0)
+				break;
+
+err:
+	g_free(idata);
+	return r;
+}
+
 /** \ingroup dev
  * Performs a new scan and attempts to identify the scanned finger against
  * a collection of previously enrolled fingerprints.
@@ -451,18 +528,140 @@ static void identify_stop_cb(struct fp_dev *dev, void *user_data)
 API_EXPORTED int fp_identify_finger_img(struct fp_dev *dev,
 	struct fp_print_data **print_gallery, size_t *match_offset,
 	struct fp_img **img)
+{
+	return sync_identify(dev, print_gallery, NULL, NULL, match_offset, img);
+}
+
+/** \ingroup dev
+ * Performs a new scan and attempts to identify the scanned finger against
+ * the prints in an index, as fp_identify_finger_img() does against a print
+ * gallery.
+ *
+ * Rather than matching the scan against the gallery in order, only the
+ * candidates the index picks out as most likely to match are examined, most
+ * likely first. This makes identification against a large gallery much
+ * faster, but a print which matches may be missed, if the index did not
+ * think it likely enough. The trade-off is controlled with
+ * fp_print_index_set_penetration().
+ *
+ * Only imaging devices support indexed identification. -ENOTSUP will be
+ * returned for other devices.
+ *
+ * \param dev the device to perform the scan.
+ * \param idx index over the prints to identify against, built with
+ * fp_print_index_new(). Each print must have been previously enrolled with a
+ * device compatible to the device selected to perform the scan.
+ * \param match_offset output location to store the array index of the matched
+ * print (if any was found) in the gallery the index was built over. Only
+ * valid if FP_VERIFY_MATCH was returned.
+ * \param img location to store the scan image. accepts NULL for no image
+ * storage. If an image is returned, it must be freed with fp_img_free() after
+ * use.
+ * \return negative code on error, otherwise a code from #fp_verify_result
+ */
+API_EXPORTED int fp_identify_finger_img_indexed(struct fp_dev *dev,
+	struct fp_print_index *idx, size_t *match_offset, struct fp_img **img)
+{
+	return sync_identify(dev, NULL, idx, NULL, match_offset, img);
+}
+
+/** \ingroup dev
+ * Performs a new scan and attempts to identify the scanned finger against
+ * the prints in a \ref gallery "gallery", as fp_identify_finger_img() does
+ * against an array of prints. The matched print is reported by its handle in
+ * the gallery, rather than by an array index.
+ *
+ * The gallery must not be changed until this function returns.
+ *
+ * \param dev the device to perform the scan.
+ * \param gallery the gallery to identify against. Each print in it must have
+ * been previously enrolled with a device compatible to the device selected to
+ * perform the scan.
+ * \param match_handle output location to store the handle of the matched
+ * print (if any was found). Only valid if FP_VERIFY_MATCH was returned.
+ * \param img location to store the scan image. accepts NULL for no image
+ * storage. If an image is returned, it must be freed with fp_img_free() after
+ * use.
+ * \return negative code on error, otherwise a code from #fp_verify_result
+ */
+API_EXPORTED int fp_identify_finger_img_gallery(struct fp_dev *dev,
+	struct fp_gallery *gallery, size_t *match_handle, struct fp_img **img)
+{
+	return sync_identify(dev, NULL, NULL, gallery, match_handle, img);
+}
+
+
+struct sync_identify_ranked_data {
+	gboolean populated;
+	int result;
+	struct fp_identify_match *matches;
+	size_t nr_matches;
+	struct fp_img *img;
+};
+
+static void sync_identify_ranked_cb(struct fp_dev *dev, int result,
+	struct fp_identify_match *matches, size_t nr_matches, struct fp_img *img,
+	void *user_data)
+{
+	struct sync_identify_ranked_data *idata = user_data;
+	idata->result = result;
+	memcpy(idata->matches, matches, nr_matches * sizeof(*matches));
+	idata->nr_matches = nr_matches;
+	idata->img = img;
+	idata->populated = TRUE;
+}
+
+/** \ingroup dev
+ * Performs a new scan and compares the scanned finger against every print
+ * in a collection of previously enrolled fingerprints, reporting the best
+ * matching ones along with their scores.
+ *
+ * Unlike fp_identify_finger_img(), this function always examines the whole
+ * print gallery. This makes it suitable for applications which need more than
+ * a yes/no answer, such as finding duplicate enrollments.
+ *
+ * The return code is fp_verify_result#FP_VERIFY_MATCH if the best candidate
+ * scored high enough to be considered a match by the driver, in which case
+ * matches[0] is the print fp_identify_finger_img() would have matched.
+ * Candidates are reported whether or not they are good enough to match.
+ *
+ * Only imaging devices support ranked identification. -ENOTSUP will be
+ * returned for other devices.
+ *
+ * \param dev the device to perform the scan.
+ * \param print_gallery NULL-terminated array of pointers to the prints to
+ * identify against. Each one must have been previously enrolled with a device
+ * compatible to the device selected to perform the scan.
+ * \param matches array of at least max_matches elements, to be filled with
+ * the best candidates from the gallery, best first. Candidates with equal
+ * scores are ordered by gallery offset.
+ * \param max_matches the number of candidates to report, at least 1.
+ * \param nr_matches output location for the number of candidates stored in
+ * matches. This is max_matches unless the gallery holds fewer prints than
+ * that which could be compared with the scan, and is only valid if
+ * FP_VERIFY_MATCH or FP_VERIFY_NO_MATCH was returned.
+ * \param img location to store the scan image. accepts NULL for no image
+ * storage. If an image is returned, it must be freed with fp_img_free() after
+ * use.
+ * \return negative code on error, otherwise a code from #fp_verify_result
+ */
+API_EXPORTED int fp_identify_finger_img_ranked(struct fp_dev *dev,
+	struct fp_print_data **print_gallery, struct fp_identify_match *matches,
+	size_t max_matches, size_t *nr_matches, struct fp_img **img)
 {
 	struct fp_driver *drv = dev->drv;
 	gboolean stopped = FALSE;
-	struct sync_identify_data *idata
-		= g_malloc0(sizeof(struct sync_identify_data));
+	struct sync_identify_ranked_data *idata
+		= g_malloc0(sizeof(struct sync_identify_ranked_data));
 	int r;
 
 	fp_dbg("to be handled by %s", drv->name);
 
-	r = fp_async_identify_start(dev, print_gallery, sync_identify_cb, idata);
+	idata->matches = matches;
+	r = fp_async_identify_ranked_start(dev, print_gallery, max_matches,
+		sync_identify_ranked_cb, idata);
 	if (r < 0) {
-		fp_err("identify_start error %d", r);
+		fp_err("identify_ranked_start error %d", r);
 		goto err;
 	}
 
@@ -480,11 +679,10 @@ API_EXPORTED int fp_identify_finger_img(struct fp_dev *dev,
 	r = idata->result;
 	switch (idata->result) {
 	case FP_VERIFY_NO_MATCH:
-		fp_dbg("result: no match");
-		break;
 	case FP_VERIFY_MATCH:
-		fp_dbg("result: match at offset %zd", idata->match_offset);
-		*match_offset = idata->match_offset;
+		fp_dbg("result: %zd candidates, best score %d", idata->nr_matches,
+			idata->nr_matches ? matches[0].score : 0);
+		*nr_matches = idata->nr_matches;
 		break;
 	case FP_VERIFY_RETRY:
 		fp_dbg("verify should retry");
@@ -513,4 +711,3 @@ err:
 	g_free(idata);
 	return r;
 }
-
@@ -0,0 +1,171 @@
+/*
+ * Work spread over pools of threads
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "workpool"
+
+#include <glib.h>
+
+#include "fp_internal.h"
+
+/* A piece of work being shared out. The submitting thread holds one
+ * reference and each helper pushed to the pool another, so that a helper
+ * which only gets to run once the submitter has stopped waiting (because the
+ * pool was busy, or could not start a thread for it) finds the work closed
+ * and simply drops its reference. */
+struct fpi_work {
+	fpi_work_fn fn;
+	/* NULL once the submitter has stopped waiting */
+	void *data;
+	GMutex lock;
+	GCond done;
+	/* helpers inside fn */
+	int running;
+	/* helpers queued or running, plus the submitter */
+	int refs;
+};
+
+static void work_unref(struct fpi_work *work)
+{
+	gboolean last;
+
+	g_mutex_lock(&work->lock);
+	last = --work->refs == 0;
+	g_mutex_unlock(&work->lock);
+
+	if (last) {
+		g_cond_clear(&work->done);
+		g_mutex_clear(&work->lock);
+		g_free(work);
+	}
+}
+
+static void work_helper(gpointer item, gpointer user_data)
+{
+	struct fpi_work *work = item;
+	void *data;
+
+	g_mutex_lock(&work->lock);
+	data = work->data;
+	if (data)
+		work->running++;
+	g_mutex_unlock(&work->lock);
+
+	if (data) {
+		work->fn(data);
+
+		g_mutex_lock(&work->lock);
+		if (--work->running == 0)
+			g_cond_signal(&work->done);
+		g_mutex_unlock(&work->lock);
+	}
+
+	work_unref(work);
+}
+
+/* Returns how many helper threads the pool offers, starting it if need be.
+ * Zero means that the submitting thread is on its own. */
+int fpi_work_pool_threads(struct fpi_work_pool *pool)
+{
+	int nthreads;
+
+	g_mutex_lock(&pool->lock);
+	if (!pool->pool && !pool->failed) {
+		GError *err = NULL;
+		/* the submitting thread also takes part in the work */
+		int n = g_get_num_processors() * pool->threads_per_cpu - 1;
+
+		if (n > 0) {
+			pool->pool = g_thread_pool_new(work_helper, NULL, n, FALSE,
+				&err);
+			if (!pool->pool) {
+				fp_err("could not create %s pool: %s", pool->name,
+					err->message);
+				g_error_free(err);
+				pool->failed = TRUE;
+			} else {
+				pool->nthreads = n;
+			}
+		}
+	}
+	nthreads = pool->nthreads;
+	g_mutex_unlock(&pool->lock);
+	return nthreads;
+}
+
+/* Asks up to nhelpers threads of the pool to call fn(data) alongside the
+ * submitting thread, which should then do its own share and call
+ * fpi_work_finish(). fn must share the work out through data, so that it
+ * returns once there is nothing left for it to claim: helpers which do not
+ * get to run in time are not waited for. */
+struct fpi_work *fpi_work_start(struct fpi_work_pool *pool, int nhelpers,
+	fpi_work_fn fn, void *data)
+{
+	struct fpi_work *work = g_malloc0(sizeof(*work));
+	int i;
+
+	work->fn = fn;
+	work->data = data;
+	g_mutex_init(&work->lock);
+	g_cond_init(&work->done);
+	work->refs = 1;
+
+	nhelpers = MIN(nhelpers, fpi_work_pool_threads(pool));
+	for (i = 0; i < nhelpers; i++) {
+		GError *err = NULL;
+
+		g_mutex_lock(&work->lock);
+		work->refs++;
+		g_mutex_unlock(&work->lock);
+
+		/* the helper is queued even if no thread could be started for
+		 * it, but there is no point in queueing more */
+		if (!g_thread_pool_push(pool->pool, work, &err)) {
+			fp_err("could not start %s thread: %s", pool->name,
+				err->message);
+			g_error_free(err);
+			break;
+		}
+	}
+	return work;
+}
+
+/* Waits for the helpers which are working on the job to be done with it.
+ * Helpers which have not started by then never will. */
+void fpi_work_finish(struct fpi_work *work)
+{
+	g_mutex_lock(&work->lock);
+	work->data = NULL;
+	while (work->running)
+		g_cond_wait(&work->done, &work->lock);
+	g_mutex_unlock(&work->lock);
+
+	work_unref(work);
+}
+
+void fpi_work_pool_exit(struct fpi_work_pool *pool)
+{
+	g_mutex_lock(&pool->lock);
+	/* helpers still queued can only belong to finished work, so they are
+	 * dropped rather than run, along with the little memory they hold */
+	if (pool->pool)
+		g_thread_pool_free(pool->pool, TRUE, TRUE);
+	pool->pool = NULL;
+	pool->nthreads = 0;
+	pool->failed = FALSE;
+	g_mutex_unlock(&pool->lock);
+}